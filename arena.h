@@ -0,0 +1,129 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Append-only storage that packs many small arrays into a few large chunks instead of separate allocations.
+// Arrays are addressed by Ref handles, which stay valid when the arena is copied or moved.
+// A chunk may be borrowed from external memory such as a mapped file, that memory must outlive the arena
+template <typename T>
+class Arena {
+    static_assert(std::is_trivially_copyable_v<T>);
+
+public:
+    struct Ref {
+        uint64_t offset = 0;
+        uint32_t chunk = 0;
+        uint32_t size = 0;
+    };
+
+    Arena() = default;
+    Arena(const Arena& other);
+    Arena(Arena&& other) = default;
+    Arena& operator=(const Arena& other);
+    Arena& operator=(Arena&& other) = default;
+
+    Ref Add(const T* items, size_t count);
+    // Registers `count` external items as a new chunk and returns its number
+    uint32_t AddBorrowedChunk(const T* items, size_t count);
+
+    const T* GetData(Ref ref) const {
+        return ref.size == 0 ? nullptr : chunks_[ref.chunk].data + ref.offset;
+    }
+
+    // Copies the arrays of `refs` into fresh owned chunks and drops everything else, borrowed chunks are kept.
+    // The refs are updated in place
+    void Compact(const std::vector<Ref*>& refs);
+
+private:
+    static constexpr size_t MIN_CHUNK_BYTES = 4096;
+    static constexpr size_t MAX_CHUNK_BYTES = 1 << 20;
+
+    struct Chunk {
+        std::unique_ptr<T[]> storage;  // Empty for a borrowed chunk
+        const T* data;
+        size_t size;
+        size_t capacity;
+    };
+
+    std::vector<Chunk> chunks_;
+    size_t next_chunk_bytes_ = MIN_CHUNK_BYTES;  // Chunks grow geometrically, small arenas stay small
+};
+
+template <typename T>
+Arena<T>::Arena(const Arena& other)
+    : next_chunk_bytes_(other.next_chunk_bytes_) {
+    chunks_.reserve(other.chunks_.size());
+    for (const Chunk& chunk : other.chunks_) {
+        if (!chunk.storage) {
+            chunks_.push_back({nullptr, chunk.data, chunk.size, chunk.capacity});
+            continue;
+        }
+        std::unique_ptr<T[]> storage(new T[chunk.capacity]);
+        std::copy(chunk.data, chunk.data + chunk.size, storage.get());
+        const T* data = storage.get();
+        chunks_.push_back({std::move(storage), data, chunk.size, chunk.capacity});
+    }
+}
+
+template <typename T>
+Arena<T>& Arena<T>::operator=(const Arena& other) {
+    if (this != &other) {
+        *this = Arena(other);
+    }
+    return *this;
+}
+
+template <typename T>
+typename Arena<T>::Ref Arena<T>::Add(const T* items, size_t count) {
+    if (count == 0) {
+        return {};
+    }
+    if (chunks_.empty() || !chunks_.back().storage || chunks_.back().capacity - chunks_.back().size < count) {
+        const size_t capacity = std::max(count, next_chunk_bytes_ / sizeof(T));
+        next_chunk_bytes_ = std::min(next_chunk_bytes_ * 2, MAX_CHUNK_BYTES);
+        std::unique_ptr<T[]> storage(new T[capacity]);
+        const T* data = storage.get();
+        chunks_.push_back({std::move(storage), data, 0, capacity});
+    }
+    Chunk& chunk = chunks_.back();
+    std::copy(items, items + count, chunk.storage.get() + chunk.size);
+    const Ref ref{chunk.size, static_cast<uint32_t>(chunks_.size() - 1), static_cast<uint32_t>(count)};
+    chunk.size += count;
+    return ref;
+}
+
+template <typename T>
+uint32_t Arena<T>::AddBorrowedChunk(const T* items, size_t count) {
+    chunks_.push_back({nullptr, items, count, count});
+    return chunks_.size() - 1;
+}
+
+template <typename T>
+void Arena<T>::Compact(const std::vector<Ref*>& refs) {
+    Arena compacted;
+    const uint32_t owned = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> borrowed_chunks(chunks_.size(), owned);
+    for (size_t chunk = 0; chunk < chunks_.size(); ++chunk) {
+        if (!chunks_[chunk].storage) {
+            borrowed_chunks[chunk] = compacted.AddBorrowedChunk(chunks_[chunk].data, chunks_[chunk].size);
+        }
+    }
+    for (Ref* ref : refs) {
+        if (ref->size == 0) {
+            continue;
+        }
+        if (borrowed_chunks[ref->chunk] != owned) {
+            ref->chunk = borrowed_chunks[ref->chunk];
+        } else {
+            *ref = compacted.Add(GetData(*ref), ref->size);
+        }
+    }
+    *this = std::move(compacted);
+}
@@ -0,0 +1,445 @@
+// Benchmarks of the SearchServer hot paths on a synthetic Zipfian corpus. Corpora and queries are generated
+// from fixed seeds, so two builds see exactly the same data. Build from the repository root with
+//     g++ -std=c++20 -O2 -DNDEBUG -I. -o search_server_benchmark benchmarks/search_server_benchmark.cpp
+//         $(ls *.cpp | grep -v '^main.cpp$') -lbenchmark -ltbb -lpthread
+// A -std=c++17 build works too but leaves out the benchmarks of the awaitable calls
+// and compare versions through the JSON report:
+//     ./search_server_benchmark --benchmark_format=json --benchmark_out=result.json
+// Arguments are the corpus size and, for the parallel benchmarks, the number of threads
+
+#include "corpus_ingestion.h"
+#include "process_queries.h"
+#include "search_server.h"
+#include "thread_pool.h"
+
+#include <benchmark/benchmark.h>
+#include <tbb/global_control.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <execution>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#include <exception>
+#include <latch>
+#endif
+
+using namespace std;
+
+namespace {
+
+const size_t VOCABULARY_SIZE = 50000;
+const double ZIPF_EXPONENT = 1.0;
+const size_t DOCUMENT_WORD_COUNT = 40;
+const size_t QUERY_COUNT = 1000;
+const size_t QUERY_WORD_COUNT = 4;
+const uint64_t CORPUS_SEED = 42;
+const uint64_t QUERY_SEED = 4242;
+
+// Samples word ranks with probability proportional to 1 / rank^exponent
+class ZipfGenerator {
+public:
+    ZipfGenerator(size_t size, double exponent, uint64_t seed)
+        : random_engine_(seed) {
+        cumulative_weights_.reserve(size);
+        double sum = 0.0;
+        for (size_t rank = 1; rank <= size; ++rank) {
+            sum += 1.0 / pow(static_cast<double>(rank), exponent);
+            cumulative_weights_.push_back(sum);
+        }
+    }
+
+    size_t operator()() {
+        // std::uniform_real_distribution differs between standard libraries, so the sample is computed by hand
+        const double sample = (random_engine_() >> 11) * (1.0 / (uint64_t{1} << 53)) * cumulative_weights_.back();
+        return lower_bound(cumulative_weights_.begin(), cumulative_weights_.end(), sample) - cumulative_weights_.begin();
+    }
+
+    uint64_t NextRandom() {
+        return random_engine_();
+    }
+
+private:
+    mt19937_64 random_engine_;
+    vector<double> cumulative_weights_;
+};
+
+// Distinct lowercase word for every rank
+string MakeWord(size_t rank) {
+    string word;
+    do {
+        word += static_cast<char>('a' + rank % 26);
+        rank /= 26;
+    } while (rank > 0);
+    return word;
+}
+
+string MakeText(ZipfGenerator& generator, size_t word_count) {
+    string text;
+    for (size_t i = 0; i < word_count; ++i) {
+        if (i > 0) {
+            text += ' ';
+        }
+        text += MakeWord(generator());
+    }
+    return text;
+}
+
+struct Corpus {
+    vector<string> texts;
+    vector<DocumentStatus> statuses;
+    vector<int> ratings;
+};
+
+// Every tenth document repeats the words of an earlier one in another order, so duplicates can be found
+Corpus MakeCorpus(size_t document_count) {
+    ZipfGenerator generator(VOCABULARY_SIZE, ZIPF_EXPONENT, CORPUS_SEED);
+    Corpus corpus;
+    corpus.texts.reserve(document_count);
+    for (size_t i = 0; i < document_count; ++i) {
+        if (i % 10 == 9) {
+            vector<string_view> words = SplitIntoWords(corpus.texts[generator.NextRandom() % i]);
+            // Fisher-Yates by hand, std::shuffle differs between standard libraries
+            for (size_t j = words.size(); j > 1; --j) {
+                swap(words[j - 1], words[generator.NextRandom() % j]);
+            }
+            string text;
+            for (const string_view word : words) {
+                text += text.empty() ? string(word) : ' ' + string(word);
+            }
+            corpus.texts.push_back(move(text));
+        } else {
+            corpus.texts.push_back(MakeText(generator, DOCUMENT_WORD_COUNT));
+        }
+        corpus.statuses.push_back(generator.NextRandom() % 8 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL);
+        corpus.ratings.push_back(static_cast<int>(generator.NextRandom() % 11) - 5);
+    }
+    return corpus;
+}
+
+vector<string> MakeQueries() {
+    ZipfGenerator generator(VOCABULARY_SIZE, ZIPF_EXPONENT, QUERY_SEED);
+    vector<string> queries;
+    queries.reserve(QUERY_COUNT);
+    for (size_t i = 0; i < QUERY_COUNT; ++i) {
+        string query = MakeText(generator, QUERY_WORD_COUNT);
+        if (i % 4 == 0) {
+            query += " -" + MakeWord(generator());
+        }
+        queries.push_back(move(query));
+    }
+    return queries;
+}
+
+const Corpus& GetCorpus(size_t document_count) {
+    static map<size_t, Corpus> corpora;
+    auto it = corpora.find(document_count);
+    if (it == corpora.end()) {
+        it = corpora.emplace(document_count, MakeCorpus(document_count)).first;
+    }
+    return it->second;
+}
+
+void AddCorpus(SearchServer& search_server, const Corpus& corpus) {
+    for (size_t i = 0; i < corpus.texts.size(); ++i) {
+        search_server.AddDocument(static_cast<int>(i), corpus.texts[i], corpus.statuses[i], {corpus.ratings[i]});
+    }
+}
+
+// Servers are built once per corpus size and shared by the read-only benchmarks
+const SearchServer& GetSearchServer(size_t document_count) {
+    static map<size_t, unique_ptr<SearchServer>> search_servers;
+    auto& search_server = search_servers[document_count];
+    if (!search_server) {
+        search_server = make_unique<SearchServer>("a b c"s);
+        AddCorpus(*search_server, GetCorpus(document_count));
+    }
+    return *search_server;
+}
+
+// Same documents ranked with BM25
+const SearchServer& GetBm25SearchServer(size_t document_count) {
+    static map<size_t, unique_ptr<SearchServer>> search_servers;
+    auto& search_server = search_servers[document_count];
+    if (!search_server) {
+        search_server = make_unique<SearchServer>(GetSearchServer(document_count));
+        RankingOptions ranking;
+        ranking.function = RankingFunction::BM25;
+        search_server->SetRanking(ranking);
+    }
+    return *search_server;
+}
+
+const vector<string>& GetQueries() {
+    static const vector<string> queries = MakeQueries();
+    return queries;
+}
+
+const auto CUSTOM_PREDICATE = [](int document_id, DocumentStatus status, int rating) {
+    return status == DocumentStatus::ACTUAL && rating > -3 && document_id % 3 != 0;
+};
+
+// Runs a benchmark iteration per query of the set, one after another
+template <typename Function>
+void RunQueries(benchmark::State& state, Function function) {
+    const vector<string>& queries = GetQueries();
+    size_t query_index = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(function(queries[query_index]));
+        query_index = (query_index + 1) % queries.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_AddDocument(benchmark::State& state) {
+    const Corpus& corpus = GetCorpus(state.range(0));
+    for (auto _ : state) {
+        SearchServer search_server("a b c"s);
+        AddCorpus(search_server, corpus);
+        benchmark::DoNotOptimize(search_server.GetDocumentCount());
+    }
+    state.SetItemsProcessed(state.iterations() * corpus.texts.size());
+}
+
+// Records of the corpus in the format of IngestCorpus. Parsing them is part of the measured work
+string MakeCorpusText(const Corpus& corpus) {
+    static const char* const status_names[] = {"ACTUAL", "IRRELEVANT", "BANNED", "REMOVED"};
+    string text;
+    for (size_t i = 0; i < corpus.texts.size(); ++i) {
+        text += to_string(i) + '\t' + status_names[static_cast<int>(corpus.statuses[i])] + '\t'
+              + to_string(corpus.ratings[i]) + '\t' + corpus.texts[i] + '\n';
+    }
+    return text;
+}
+
+void BM_IngestCorpus(benchmark::State& state) {
+    const Corpus& corpus = GetCorpus(state.range(0));
+    const string corpus_text = MakeCorpusText(corpus);
+    for (auto _ : state) {
+        SearchServer search_server("a b c"s);
+        istringstream input(corpus_text);
+        IngestCorpus(search_server, input);
+        benchmark::DoNotOptimize(search_server.GetDocumentCount());
+    }
+    state.SetItemsProcessed(state.iterations() * corpus.texts.size());
+    state.SetBytesProcessed(state.iterations() * corpus_text.size());
+}
+
+void BM_FindTopDocumentsStatusSeq(benchmark::State& state) {
+    const SearchServer& search_server = GetSearchServer(state.range(0));
+    RunQueries(state, [&](const string& query) {
+        return search_server.FindTopDocuments(execution::seq, query, DocumentStatus::ACTUAL);
+    });
+}
+
+void BM_FindTopDocumentsStatusPar(benchmark::State& state) {
+    const SearchServer& search_server = GetSearchServer(state.range(0));
+    tbb::global_control thread_limit(tbb::global_control::max_allowed_parallelism, state.range(1));
+    RunQueries(state, [&](const string& query) {
+        return search_server.FindTopDocuments(execution::par, query, DocumentStatus::ACTUAL);
+    });
+}
+
+void BM_FindTopDocumentsBm25Seq(benchmark::State& state) {
+    const SearchServer& search_server = GetBm25SearchServer(state.range(0));
+    RunQueries(state, [&](const string& query) {
+        return search_server.FindTopDocuments(execution::seq, query, DocumentStatus::ACTUAL);
+    });
+}
+
+void BM_FindTopDocumentsPredicateSeq(benchmark::State& state) {
+    const SearchServer& search_server = GetSearchServer(state.range(0));
+    RunQueries(state, [&](const string& query) {
+        return search_server.FindTopDocuments(execution::seq, query, CUSTOM_PREDICATE);
+    });
+}
+
+void BM_FindTopDocumentsPredicatePar(benchmark::State& state) {
+    const SearchServer& search_server = GetSearchServer(state.range(0));
+    tbb::global_control thread_limit(tbb::global_control::max_allowed_parallelism, state.range(1));
+    RunQueries(state, [&](const string& query) {
+        return search_server.FindTopDocuments(execution::par, query, CUSTOM_PREDICATE);
+    });
+}
+
+void BM_MatchDocumentSeq(benchmark::State& state) {
+    const SearchServer& search_server = GetSearchServer(state.range(0));
+    int document_id = 0;
+    RunQueries(state, [&](const string& query) {
+        document_id = (document_id + 7919) % search_server.GetDocumentCount();
+        return search_server.MatchDocument(execution::seq, query, document_id);
+    });
+}
+
+void BM_MatchDocumentPar(benchmark::State& state) {
+    const SearchServer& search_server = GetSearchServer(state.range(0));
+    tbb::global_control thread_limit(tbb::global_control::max_allowed_parallelism, state.range(1));
+    int document_id = 0;
+    RunQueries(state, [&](const string& query) {
+        document_id = (document_id + 7919) % search_server.GetDocumentCount();
+        return search_server.MatchDocument(execution::par, query, document_id);
+    });
+}
+
+// Every iteration removes a fixed set of documents from a fresh copy of the server, the copy is not timed
+template <typename ExecutionPolicy>
+void RunRemoveDocuments(benchmark::State& state, const ExecutionPolicy& policy) {
+    const SearchServer& search_server = GetSearchServer(state.range(0));
+    const int removed_count = min(1000, search_server.GetDocumentCount());
+    for (auto _ : state) {
+        state.PauseTiming();
+        SearchServer copy = search_server;
+        state.ResumeTiming();
+        for (int i = 0; i < removed_count; ++i) {
+            copy.RemoveDocument(policy, static_cast<int>(static_cast<uint64_t>(i) * search_server.GetDocumentCount() / removed_count));
+        }
+        benchmark::DoNotOptimize(copy.GetDocumentCount());
+    }
+    state.SetItemsProcessed(state.iterations() * removed_count);
+}
+
+void BM_RemoveDocumentSeq(benchmark::State& state) {
+    RunRemoveDocuments(state, execution::seq);
+}
+
+void BM_RemoveDocumentPar(benchmark::State& state) {
+    tbb::global_control thread_limit(tbb::global_control::max_allowed_parallelism, state.range(1));
+    RunRemoveDocuments(state, execution::par);
+}
+
+// Copy of the shared server running on its own pool, the copy is not timed
+SearchServer CopySearchServer(size_t document_count, ThreadPool& thread_pool) {
+    SearchServer search_server = GetSearchServer(document_count);
+    search_server.SetThreadPool(&thread_pool);
+    return search_server;
+}
+
+void BM_ProcessQueries(benchmark::State& state) {
+    ThreadPool thread_pool(state.range(1));
+    const SearchServer search_server = CopySearchServer(state.range(0), thread_pool);
+    const vector<string>& queries = GetQueries();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(ProcessQueries(search_server, queries));
+    }
+    state.SetItemsProcessed(state.iterations() * queries.size());
+}
+
+void BM_ProcessQueriesJoined(benchmark::State& state) {
+    const SearchServer& search_server = GetSearchServer(state.range(0));
+    const vector<string>& queries = GetQueries();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(ProcessQueriesJoined(search_server, queries));
+    }
+    state.SetItemsProcessed(state.iterations() * queries.size());
+}
+
+#if defined(__cpp_impl_coroutine)
+// Coroutine that starts at once and frees itself when it ends
+struct DetachedTask {
+    struct promise_type {
+        DetachedTask get_return_object() {
+            return {};
+        }
+        suspend_never initial_suspend() noexcept {
+            return {};
+        }
+        suspend_never final_suspend() noexcept {
+            return {};
+        }
+        void return_void() {
+        }
+        void unhandled_exception() {
+            terminate();
+        }
+    };
+};
+
+DetachedTask AwaitFindTopDocuments(const SearchServer& search_server, const string& query, latch& done) {
+    const vector<Document> documents = co_await search_server.FindTopDocumentsAsync(query);
+    benchmark::DoNotOptimize(documents.data());
+    done.count_down();
+}
+
+// Every iteration awaits all queries at once, the suspended coroutines hold no thread
+void BM_FindTopDocumentsAsync(benchmark::State& state) {
+    ThreadPool thread_pool(state.range(1));
+    const SearchServer search_server = CopySearchServer(state.range(0), thread_pool);
+    const vector<string>& queries = GetQueries();
+    for (auto _ : state) {
+        latch done(queries.size());
+        for (const string& query : queries) {
+            AwaitFindTopDocuments(search_server, query, done);
+        }
+        done.wait();
+    }
+    state.SetItemsProcessed(state.iterations() * queries.size());
+}
+#endif
+
+template <typename ExecutionPolicy>
+void RunRemoveDuplicates(benchmark::State& state, const ExecutionPolicy& policy) {
+    const SearchServer& search_server = GetSearchServer(state.range(0));
+    for (auto _ : state) {
+        state.PauseTiming();
+        SearchServer copy = search_server;
+        state.ResumeTiming();
+        benchmark::DoNotOptimize(copy.RemoveDuplicates(policy));
+    }
+    state.SetItemsProcessed(state.iterations() * search_server.GetDocumentCount());
+}
+
+void BM_RemoveDuplicatesSeq(benchmark::State& state) {
+    RunRemoveDuplicates(state, execution::seq);
+}
+
+void BM_RemoveDuplicatesPar(benchmark::State& state) {
+    tbb::global_control thread_limit(tbb::global_control::max_allowed_parallelism, state.range(1));
+    RunRemoveDuplicates(state, execution::par);
+}
+
+void CorpusSizes(benchmark::internal::Benchmark* benchmark) {
+    benchmark->ArgName("documents");
+    for (const int document_count : {10000, 100000}) {
+        benchmark->Arg(document_count);
+    }
+}
+
+void CorpusSizesAndThreads(benchmark::internal::Benchmark* benchmark) {
+    benchmark->ArgNames({"documents", "threads"});
+    for (const int document_count : {10000, 100000}) {
+        for (const int thread_count : {1, 2, 4, 8}) {
+            benchmark->Args({document_count, thread_count});
+        }
+    }
+}
+
+}  // namespace
+
+BENCHMARK(BM_AddDocument)->Apply(CorpusSizes)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_IngestCorpus)->Apply(CorpusSizes)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_FindTopDocumentsStatusSeq)->Apply(CorpusSizes)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_FindTopDocumentsStatusPar)->Apply(CorpusSizesAndThreads)->Unit(benchmark::kMicrosecond)->UseRealTime();
+BENCHMARK(BM_FindTopDocumentsBm25Seq)->Apply(CorpusSizes)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_FindTopDocumentsPredicateSeq)->Apply(CorpusSizes)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_FindTopDocumentsPredicatePar)->Apply(CorpusSizesAndThreads)->Unit(benchmark::kMicrosecond)->UseRealTime();
+BENCHMARK(BM_MatchDocumentSeq)->Apply(CorpusSizes)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_MatchDocumentPar)->Apply(CorpusSizesAndThreads)->Unit(benchmark::kMicrosecond)->UseRealTime();
+BENCHMARK(BM_RemoveDocumentSeq)->Apply(CorpusSizes)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_RemoveDocumentPar)->Apply(CorpusSizesAndThreads)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_ProcessQueries)->Apply(CorpusSizesAndThreads)->Unit(benchmark::kMillisecond)->UseRealTime();
+#if defined(__cpp_impl_coroutine)
+BENCHMARK(BM_FindTopDocumentsAsync)->Apply(CorpusSizesAndThreads)->Unit(benchmark::kMillisecond)->UseRealTime();
+#endif
+BENCHMARK(BM_ProcessQueriesJoined)->Apply(CorpusSizes)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_RemoveDuplicatesSeq)->Apply(CorpusSizes)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_RemoveDuplicatesPar)->Apply(CorpusSizesAndThreads)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,448 @@
+#include "compressed_posting_list.h"
+
+#include <cassert>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+unsigned BitWidth(uint32_t value) {
+    unsigned width = 0;
+    while (value != 0) {
+        ++width;
+        value >>= 1;
+    }
+    return width;
+}
+
+void PackBits(const uint32_t* values, size_t count, unsigned width, vector<uint8_t>& out) {
+    uint64_t buffer = 0;
+    unsigned filled = 0;
+    for (size_t i = 0; i < count; ++i) {
+        buffer |= uint64_t{values[i]} << filled;
+        filled += width;
+        while (filled >= 8) {
+            out.push_back(static_cast<uint8_t>(buffer));
+            buffer >>= 8;
+            filled -= 8;
+        }
+    }
+    if (filled > 0) {
+        out.push_back(static_cast<uint8_t>(buffer));
+    }
+}
+
+// Reads whole 64-bit words, the caller guarantees 8 readable bytes past the packed data
+void UnpackBits(const uint8_t* data, size_t count, unsigned width, uint32_t* values) {
+    if (width == 0) {
+        fill(values, values + count, 0u);
+        return;
+    }
+    const uint64_t mask = (uint64_t{1} << width) - 1;
+    size_t bit_position = 0;
+    for (size_t i = 0; i < count; ++i, bit_position += width) {
+        uint64_t word;
+        memcpy(&word, data + bit_position / 8, sizeof(word));
+        values[i] = static_cast<uint32_t>((word >> (bit_position % 8)) & mask);
+    }
+}
+
+size_t PackedSize(size_t count, unsigned width) {
+    return (count * width + 7) / 8;
+}
+
+// Bytes taken by an encoded block of `count` postings
+size_t EncodedBlockSize(const uint8_t* payload, size_t count) {
+    return 2 + PackedSize(count - 1, payload[0]) + PackedSize(count, payload[1]);
+}
+
+// In-place inclusive prefix sum, four lanes at a time with SSE2
+void PrefixSum(uint32_t* values, size_t count) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    __m128i carry = _mm_setzero_si128();
+    for (; i + 4 <= count; i += 4) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i));
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+        x = _mm_add_epi32(x, carry);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(values + i), x);
+        carry = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+    }
+#endif
+    for (; i < count; ++i) {
+        if (i > 0) {
+            values[i] += values[i - 1];
+        }
+    }
+}
+
+}  // namespace
+
+CompressedPostingList::CompressedPostingList()
+    : bytes_(PADDING_SIZE, 0) {
+}
+
+CompressedPostingList CompressedPostingList::FromBorrowedBlocks(const BlockInfo* blocks, size_t block_count, const uint8_t* bytes,
+                                                                size_t size, const PostingBound& bound) {
+    CompressedPostingList result;
+    vector<uint8_t>().swap(result.bytes_);
+    result.borrowed_blocks_ = blocks;
+    result.borrowed_block_count_ = block_count;
+    result.borrowed_bytes_ = bytes;
+    result.size_ = size;
+    result.bound_ = bound;
+    return result;
+}
+
+bool CompressedPostingList::IsValid(size_t payload_size, DocumentOrdinal ordinal_end) const {
+    const BlockInfo* blocks = GetBlocks();
+    const uint8_t* bytes = GetBytes();
+    uint64_t payload_end = 0;
+    uint64_t posting_count = tail_ordinals_.size();
+    DocumentOrdinal ordinals[BLOCK_SIZE];
+    uint32_t term_counts[BLOCK_SIZE];
+    for (size_t block = 0; block < GetBlockCount(); ++block) {
+        const BlockInfo& info = blocks[block];
+        if (info.size == 0 || info.size > BLOCK_SIZE || info.offset < payload_end || info.first_ordinal > info.last_ordinal
+            || info.last_ordinal >= ordinal_end || (block > 0 && info.first_ordinal <= blocks[block - 1].last_ordinal)
+            || uint64_t{info.offset} + 2 + PADDING_SIZE > payload_size) {
+            return false;
+        }
+        const uint8_t* payload = bytes + info.offset;
+        if (payload[0] > 32 || payload[1] > 32) {
+            return false;
+        }
+        payload_end = uint64_t{info.offset} + EncodedBlockSize(payload, info.size);
+        if (payload_end + PADDING_SIZE > payload_size) {
+            return false;
+        }
+        // Gaps are positive, so a wrapped sum shows up as a decrease
+        DecodeBlock(block, ordinals, term_counts);
+        for (size_t i = 0; i < info.size; ++i) {
+            if ((i > 0 && ordinals[i] <= ordinals[i - 1]) || term_counts[i] == 0) {
+                return false;
+            }
+        }
+        if (ordinals[info.size - 1] != info.last_ordinal) {
+            return false;
+        }
+        posting_count += info.size;
+    }
+    return posting_count == size_;
+}
+
+void CompressedPostingList::MakeBlocksOwned() {
+    if (borrowed_blocks_ == nullptr) {
+        return;
+    }
+    blocks_.assign(borrowed_blocks_, borrowed_blocks_ + borrowed_block_count_);
+    const size_t payload_size = blocks_.empty() ? 0 : blocks_.back().offset + EncodedBlockSize(borrowed_bytes_ + blocks_.back().offset,
+                                                                                             blocks_.back().size);
+    bytes_.assign(borrowed_bytes_, borrowed_bytes_ + payload_size);
+    bytes_.resize(payload_size + PADDING_SIZE, 0);
+    borrowed_blocks_ = nullptr;
+    borrowed_block_count_ = 0;
+    borrowed_bytes_ = nullptr;
+}
+
+void CompressedPostingList::Append(DocumentOrdinal ordinal, uint32_t term_count, uint32_t word_count) {
+    assert(term_count > 0);
+    assert(empty() || (tail_ordinals_.empty() ? GetBlocks()[GetBlockCount() - 1].last_ordinal : tail_ordinals_.back()) < ordinal);
+    tail_ordinals_.push_back(ordinal);
+    tail_counts_.push_back(term_count);
+    ++size_;
+    bound_.Add(term_count, word_count);
+    tail_bound_.Add(term_count, word_count);
+
+    if (tail_ordinals_.size() == BLOCK_SIZE) {
+        MakeBlocksOwned();
+        const auto payload = EncodeBlock(tail_ordinals_.data(), tail_counts_.data(), tail_ordinals_.size());
+        const uint32_t offset = bytes_.size() - PADDING_SIZE;
+        bytes_.insert(bytes_.end() - PADDING_SIZE, payload.begin(), payload.end());
+        blocks_.push_back({tail_ordinals_.front(), tail_ordinals_.back(), offset, static_cast<uint32_t>(BLOCK_SIZE), tail_bound_});
+        tail_ordinals_.clear();
+        tail_counts_.clear();
+        tail_bound_ = {};
+    }
+}
+
+bool CompressedPostingList::Erase(DocumentOrdinal ordinal) {
+    const size_t block = FindBlock(ordinal, 0);
+    if (block > GetBlockCount()) {
+        return false;
+    }
+    if (block == GetBlockCount()) {
+        const auto it = lower_bound(tail_ordinals_.begin(), tail_ordinals_.end(), ordinal);
+        if (it == tail_ordinals_.end() || *it != ordinal) {
+            return false;
+        }
+        tail_counts_.erase(tail_counts_.begin() + (it - tail_ordinals_.begin()));
+        tail_ordinals_.erase(it);
+        --size_;
+        return true;
+    }
+
+    DocumentOrdinal ordinals[BLOCK_SIZE];
+    uint32_t term_counts[BLOCK_SIZE];
+    size_t count = DecodeBlock(block, ordinals, term_counts);
+    const size_t index = lower_bound(ordinals, ordinals + count, ordinal) - ordinals;
+    if (index == count || ordinals[index] != ordinal) {
+        return false;
+    }
+    MakeBlocksOwned();
+    copy(ordinals + index + 1, ordinals + count, ordinals + index);
+    copy(term_counts + index + 1, term_counts + count, term_counts + index);
+    --count;
+    --size_;
+
+    if (count == 0) {
+        ReplaceBlockPayload(block, {});
+        blocks_.erase(blocks_.begin() + block);
+        return true;
+    }
+    ReplaceBlockPayload(block, EncodeBlock(ordinals, term_counts, count));
+    blocks_[block].first_ordinal = ordinals[0];
+    blocks_[block].last_ordinal = ordinals[count - 1];
+    blocks_[block].size = count;
+    return true;
+}
+
+size_t CompressedPostingList::Erase(const DocumentOrdinal* first, const DocumentOrdinal* last, const uint32_t* word_counts) {
+    if (last - first == 1) {
+        if (!Erase(*first)) {
+            return 0;
+        }
+        UpdateBound(word_counts);
+        return 1;
+    }
+    CompressedPostingList result;
+    size_t erased = 0;
+    ForEach([&](DocumentOrdinal ordinal, uint32_t term_count) {
+        while (first != last && *first < ordinal) {
+            ++first;
+        }
+        if (first != last && *first == ordinal) {
+            ++erased;
+            return;
+        }
+        result.Append(ordinal, term_count, word_counts[ordinal]);
+    });
+    if (erased > 0) {
+        *this = move(result);
+    }
+    return erased;
+}
+
+bool CompressedPostingList::Contains(DocumentOrdinal ordinal) const {
+    const size_t block = FindBlock(ordinal, 0);
+    if (block > GetBlockCount()) {
+        return false;
+    }
+    if (block == GetBlockCount()) {
+        return binary_search(tail_ordinals_.begin(), tail_ordinals_.end(), ordinal);
+    }
+    if (GetBlocks()[block].first_ordinal > ordinal) {
+        return false;
+    }
+    DocumentOrdinal ordinals[BLOCK_SIZE];
+    const size_t count = DecodeBlock(block, ordinals, nullptr);
+    return binary_search(ordinals, ordinals + count, ordinal);
+}
+
+const PostingBound& CompressedPostingList::GetBound() const {
+    return bound_;
+}
+
+void CompressedPostingList::UpdateBound(const uint32_t* word_counts) {
+    PostingBound bound;
+    ForEach([&bound, word_counts](DocumentOrdinal ordinal, uint32_t term_count) {
+        bound.Add(term_count, word_counts[ordinal]);
+    });
+    bound_ = bound;
+    tail_bound_ = {};
+    for (size_t i = 0; i < tail_ordinals_.size(); ++i) {
+        tail_bound_.Add(tail_counts_[i], word_counts[tail_ordinals_[i]]);
+    }
+}
+
+void CompressedPostingList::ExportBlocks(vector<BlockInfo>& blocks, vector<uint8_t>& bytes) const {
+    const size_t base = bytes.size();
+    const BlockInfo* own_blocks = GetBlocks();
+    const size_t block_count = GetBlockCount();
+    size_t payload_size = 0;
+    for (size_t i = 0; i < block_count; ++i) {
+        BlockInfo info = own_blocks[i];
+        info.offset += base;
+        blocks.push_back(info);
+        payload_size = max<size_t>(payload_size, own_blocks[i].offset + EncodedBlockSize(GetBytes() + own_blocks[i].offset, own_blocks[i].size));
+    }
+    bytes.insert(bytes.end(), GetBytes(), GetBytes() + payload_size);
+    if (!tail_ordinals_.empty()) {
+        const auto payload = EncodeBlock(tail_ordinals_.data(), tail_counts_.data(), tail_ordinals_.size());
+        blocks.push_back({tail_ordinals_.front(), tail_ordinals_.back(), static_cast<uint32_t>(bytes.size()),
+                          static_cast<uint32_t>(tail_ordinals_.size()), tail_bound_});
+        bytes.insert(bytes.end(), payload.begin(), payload.end());
+    }
+    bytes.resize(bytes.size() + PADDING_SIZE, 0);
+}
+
+size_t CompressedPostingList::GetMemoryUsage() const {
+    return sizeof(*this)
+        + blocks_.capacity() * sizeof(BlockInfo)
+        + bytes_.capacity()
+        + tail_ordinals_.capacity() * sizeof(DocumentOrdinal)
+        + tail_counts_.capacity() * sizeof(uint32_t);
+}
+
+size_t CompressedPostingList::size() const {
+    return size_;
+}
+
+bool CompressedPostingList::empty() const {
+    return size_ == 0;
+}
+
+size_t CompressedPostingList::FindBlock(DocumentOrdinal target, size_t from) const {
+    const BlockInfo* blocks = GetBlocks();
+    const size_t block_count = GetBlockCount();
+    if (from < block_count) {
+        const BlockInfo* it = lower_bound(blocks + from, blocks + block_count, target,
+            [](const BlockInfo& block, DocumentOrdinal ordinal) {
+                return block.last_ordinal < ordinal;
+            });
+        if (it != blocks + block_count) {
+            return it - blocks;
+        }
+    }
+    if (from <= block_count && !tail_ordinals_.empty() && tail_ordinals_.back() >= target) {
+        return block_count;
+    }
+    return block_count + 1;
+}
+
+// Payload layout: gap bit width, count bit width, then size - 1 packed gaps (minus one)
+// followed by size packed counts (minus one)
+size_t CompressedPostingList::DecodeBlock(size_t block, DocumentOrdinal* ordinals, uint32_t* term_counts) const {
+    if (block == GetBlockCount()) {
+        if (ordinals != nullptr) {
+            copy(tail_ordinals_.begin(), tail_ordinals_.end(), ordinals);
+        }
+        if (term_counts != nullptr) {
+            copy(tail_counts_.begin(), tail_counts_.end(), term_counts);
+        }
+        return tail_ordinals_.size();
+    }
+    if (block > GetBlockCount()) {
+        return 0;
+    }
+
+    const BlockInfo& info = GetBlocks()[block];
+    const uint8_t* data = GetBytes() + info.offset;
+    const unsigned gap_width = data[0];
+    const unsigned count_width = data[1];
+    data += 2;
+    if (ordinals != nullptr) {
+        ordinals[0] = info.first_ordinal;
+        UnpackBits(data, info.size - 1, gap_width, ordinals + 1);
+        for (size_t i = 1; i < info.size; ++i) {
+            ++ordinals[i];
+        }
+        PrefixSum(ordinals, info.size);
+    }
+    if (term_counts != nullptr) {
+        UnpackBits(data + PackedSize(info.size - 1, gap_width), info.size, count_width, term_counts);
+        for (size_t i = 0; i < info.size; ++i) {
+            ++term_counts[i];
+        }
+    }
+    return info.size;
+}
+
+vector<uint8_t> CompressedPostingList::EncodeBlock(const DocumentOrdinal* ordinals, const uint32_t* term_counts, size_t count) {
+    uint32_t gaps[BLOCK_SIZE];
+    uint32_t counts[BLOCK_SIZE];
+    uint32_t max_gap = 0;
+    uint32_t max_count = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (i > 0) {
+            gaps[i - 1] = ordinals[i] - ordinals[i - 1] - 1;
+            max_gap = max(max_gap, gaps[i - 1]);
+        }
+        counts[i] = term_counts[i] - 1;
+        max_count = max(max_count, counts[i]);
+    }
+    const unsigned gap_width = BitWidth(max_gap);
+    const unsigned count_width = BitWidth(max_count);
+
+    vector<uint8_t> payload;
+    payload.reserve(2 + PackedSize(count - 1, gap_width) + PackedSize(count, count_width));
+    payload.push_back(static_cast<uint8_t>(gap_width));
+    payload.push_back(static_cast<uint8_t>(count_width));
+    PackBits(gaps, count - 1, gap_width, payload);
+    PackBits(counts, count, count_width, payload);
+    return payload;
+}
+
+void CompressedPostingList::ReplaceBlockPayload(size_t block, const vector<uint8_t>& payload) {
+    const size_t begin = blocks_[block].offset;
+    const size_t end = block + 1 < blocks_.size() ? blocks_[block + 1].offset : bytes_.size() - PADDING_SIZE;
+    const size_t common = min(end - begin, payload.size());
+    copy(payload.begin(), payload.begin() + common, bytes_.begin() + begin);
+    if (payload.size() < end - begin) {
+        bytes_.erase(bytes_.begin() + begin + common, bytes_.begin() + end);
+    } else {
+        bytes_.insert(bytes_.begin() + begin + common, payload.begin() + common, payload.end());
+    }
+    const int64_t shift = static_cast<int64_t>(payload.size()) - static_cast<int64_t>(end - begin);
+    for (size_t i = block + 1; i < blocks_.size(); ++i) {
+        blocks_[i].offset += shift;
+    }
+}
+
+CompressedPostingList::Cursor::Cursor(const CompressedPostingList& postings, const uint32_t* word_counts,
+                                      DocumentOrdinal range_begin, DocumentOrdinal range_end)
+    : postings_(&postings)
+    , word_counts_(word_counts)
+    , range_end_(range_end) {
+    LoadBlock(postings.FindBlock(range_begin, 0));
+    bound_block_ = block_;
+    if (!IsEnd()) {
+        position_ = lower_bound(ordinals_, ordinals_ + size_, range_begin) - ordinals_;
+    }
+}
+
+void CompressedPostingList::Cursor::LoadBlock(size_t block) {
+    block_ = block;
+    position_ = 0;
+    size_ = 0;
+    if (block > postings_->GetBlockCount()) {
+        return;
+    }
+    const size_t count = postings_->DecodeBlock(block, ordinals_, term_counts_);
+    if (count == 0 || ordinals_[0] >= range_end_) {
+        return;
+    }
+    size_ = lower_bound(ordinals_, ordinals_ + count, range_end_) - ordinals_;
+}
+
+const PostingBound& CompressedPostingList::Cursor::GetBound(DocumentOrdinal target) {
+    static const PostingBound empty_bound;
+    const size_t block_count = postings_->GetBlockCount();
+    bound_block_ = max(bound_block_, block_);
+    if (bound_block_ >= block_count || postings_->GetBlocks()[bound_block_].last_ordinal < target) {
+        bound_block_ = postings_->FindBlock(target, bound_block_);
+    }
+    if (bound_block_ == block_count) {
+        return postings_->tail_bound_;
+    }
+    if (bound_block_ > block_count || postings_->GetBlocks()[bound_block_].first_ordinal > target) {
+        return empty_bound;
+    }
+    return postings_->GetBlocks()[bound_block_].bound;
+}
\ No newline at end of file
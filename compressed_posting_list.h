@@ -0,0 +1,171 @@
+#pragma once
+
+#include "posting_list.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Postings of a single term packed into blocks of BLOCK_SIZE entries. Every block stores bit-packed
+// ordinal gaps and term counts, a skip entry with its ordinal range lets cursors jump over whole blocks.
+// Skip entries also hold the bound of their block, so evaluation can skip blocks that cannot score enough.
+// New postings collect in an uncompressed tail until it fills a block.
+// A list may borrow its blocks from external memory such as a mapped snapshot, it copies them on first change
+class CompressedPostingList {
+public:
+    static const size_t BLOCK_SIZE = 128;
+    // Zero bytes that must follow the last block payload, decoding reads whole words past it
+    static const size_t PADDING_SIZE = 8;
+
+    struct BlockInfo {
+        DocumentOrdinal first_ordinal;
+        DocumentOrdinal last_ordinal;
+        uint32_t offset;  // Position of the block payload in the list bytes
+        uint32_t size;
+        PostingBound bound;  // Stays an upper bound as postings of the block are erased
+    };
+
+    class Cursor;
+
+    CompressedPostingList();
+    // Borrows blocks and padded payload bytes, they must outlive the list or its first change
+    static CompressedPostingList FromBorrowedBlocks(const BlockInfo* blocks, size_t block_count, const uint8_t* bytes,
+                                                    size_t size, const PostingBound& bound);
+    // Decodes every block and checks that payloads lie in order within payload_size bytes with padding, that
+    // ordinals increase and stay below ordinal_end and that the block sizes add up to the list size
+    bool IsValid(size_t payload_size, DocumentOrdinal ordinal_end) const;
+
+    // Ordinal must be greater than any ordinal already in the list, word_count is the one of the document
+    void Append(DocumentOrdinal ordinal, uint32_t term_count, uint32_t word_count);
+    bool Erase(DocumentOrdinal ordinal);
+    // Erases the postings of the sorted ordinals [first, last) with one rebuild, returns how many were found.
+    // word_counts maps ordinals to document word counts, the bounds are exact afterwards
+    size_t Erase(const DocumentOrdinal* first, const DocumentOrdinal* last, const uint32_t* word_counts);
+    bool Contains(DocumentOrdinal ordinal) const;
+
+    // Bound of the postings. Erasing a posting does not tighten it, UpdateBound makes it exact
+    const PostingBound& GetBound() const;
+    // Block bounds are left as they are
+    void UpdateBound(const uint32_t* word_counts);
+    // Calls function(ordinal, term_count) for every posting in ordinal order
+    template <typename Function>
+    void ForEach(Function function) const;
+
+    // Blocks and payload bytes holding every posting, the tail is encoded as a final block.
+    // Payload offsets start at the current size of bytes, PADDING_SIZE zero bytes are appended
+    void ExportBlocks(std::vector<BlockInfo>& blocks, std::vector<uint8_t>& bytes) const;
+
+    // Heap memory owned by the list, borrowed blocks are not counted
+    size_t GetMemoryUsage() const;
+    size_t size() const;
+    bool empty() const;
+
+private:
+    std::vector<BlockInfo> blocks_;
+    // Block payloads followed by PADDING_SIZE zero bytes
+    std::vector<uint8_t> bytes_;
+    // Set while the blocks are borrowed, blocks_ and bytes_ are empty then
+    const BlockInfo* borrowed_blocks_ = nullptr;
+    size_t borrowed_block_count_ = 0;
+    const uint8_t* borrowed_bytes_ = nullptr;
+    std::vector<DocumentOrdinal> tail_ordinals_;
+    std::vector<uint32_t> tail_counts_;
+    PostingBound tail_bound_;
+    size_t size_ = 0;
+    PostingBound bound_;
+
+    const BlockInfo* GetBlocks() const {
+        return borrowed_blocks_ != nullptr ? borrowed_blocks_ : blocks_.data();
+    }
+    size_t GetBlockCount() const {
+        return borrowed_blocks_ != nullptr ? borrowed_block_count_ : blocks_.size();
+    }
+    const uint8_t* GetBytes() const {
+        return borrowed_blocks_ != nullptr ? borrowed_bytes_ : bytes_.data();
+    }
+    // Copies borrowed blocks into owned storage before a change
+    void MakeBlocksOwned();
+
+    // Index of the first block from `from` that may contain ordinals >= target.
+    // blocks_.size() stands for the tail, blocks_.size() + 1 for the end of the list
+    size_t FindBlock(DocumentOrdinal target, size_t from) const;
+    // Decodes a block or the tail, returns the number of postings. Either output may be nullptr
+    size_t DecodeBlock(size_t block, DocumentOrdinal* ordinals, uint32_t* term_counts) const;
+    static std::vector<uint8_t> EncodeBlock(const DocumentOrdinal* ordinals, const uint32_t* term_counts, size_t count);
+    // Replaces the payload of a block, shifting the payloads after it
+    void ReplaceBlockPayload(size_t block, const std::vector<uint8_t>& payload);
+};
+
+class CompressedPostingList::Cursor {
+public:
+    // Only visits postings with ordinals in [range_begin, range_end).
+    // word_counts maps ordinals to document word counts and must outlive the cursor
+    Cursor(const CompressedPostingList& postings, const uint32_t* word_counts,
+           DocumentOrdinal range_begin, DocumentOrdinal range_end);
+
+    bool IsEnd() const {
+        return position_ == size_;
+    }
+
+    DocumentOrdinal GetOrdinal() const {
+        return ordinals_[position_];
+    }
+
+    uint32_t GetTermCount() const {
+        return term_counts_[position_];
+    }
+
+    uint32_t GetWordCount() const {
+        return word_counts_[ordinals_[position_]];
+    }
+
+    // Bound of the block that may hold target, found from the skip entries without decoding the block.
+    // Targets must not decrease. An empty bound means that no posting holds target
+    const PostingBound& GetBound(DocumentOrdinal target);
+
+    void Next() {
+        if (++position_ == size_) {
+            LoadBlock(block_ + 1);
+        }
+    }
+
+    // Moves to the first posting with ordinal >= target, skipping blocks that end before it
+    void Advance(DocumentOrdinal target) {
+        if (IsEnd() || ordinals_[position_] >= target) {
+            return;
+        }
+        if (ordinals_[size_ - 1] < target) {
+            LoadBlock(postings_->FindBlock(target, block_ + 1));
+            if (IsEnd()) {
+                return;
+            }
+        }
+        position_ = std::lower_bound(ordinals_ + position_, ordinals_ + size_, target) - ordinals_;
+    }
+
+private:
+    const CompressedPostingList* postings_;
+    const uint32_t* word_counts_;
+    DocumentOrdinal range_end_;
+    size_t block_ = 0;
+    size_t bound_block_ = 0;  // Block of the last GetBound call
+    size_t position_ = 0;
+    size_t size_ = 0;
+    DocumentOrdinal ordinals_[BLOCK_SIZE];
+    uint32_t term_counts_[BLOCK_SIZE];
+
+    void LoadBlock(size_t block);
+};
+
+template <typename Function>
+void CompressedPostingList::ForEach(Function function) const {
+    DocumentOrdinal ordinals[BLOCK_SIZE];
+    uint32_t term_counts[BLOCK_SIZE];
+    for (size_t block = 0; block <= GetBlockCount(); ++block) {
+        const size_t count = DecodeBlock(block, ordinals, term_counts);
+        for (size_t i = 0; i < count; ++i) {
+            function(ordinals[i], term_counts[i]);
+        }
+    }
+}
\ No newline at end of file
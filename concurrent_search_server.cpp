@@ -0,0 +1,299 @@
+#include "concurrent_search_server.h"
+
+using namespace std;
+
+ConcurrentSearchServer::ConcurrentSearchServer(const string& stop_words_text)
+    : ConcurrentSearchServer(string_view(stop_words_text)) {
+}
+
+ConcurrentSearchServer::ConcurrentSearchServer(string_view stop_words_text)
+    : ConcurrentSearchServer(SplitIntoWords(stop_words_text)) {
+}
+
+ConcurrentSearchServer::~ConcurrentSearchServer() {
+    {
+        lock_guard guard(merge_mutex_);
+        is_stopping_ = true;
+    }
+    merge_condition_.notify_all();
+    merge_thread_.join();
+}
+
+shared_ptr<const ConcurrentSearchServer::Generation> ConcurrentSearchServer::GetGeneration() const {
+    lock_guard guard(generation_mutex_);
+    return generation_;
+}
+
+void ConcurrentSearchServer::AddDocument(int document_id, string_view document, DocumentStatus status, const vector<int>& ratings) {
+    lock_guard guard(write_mutex_);
+    const auto current = GetGeneration();
+    if (current->FindSegment(document_id) != current->segments_.size()) {
+        throw invalid_argument("Document id is already taken");
+    }
+    auto generation = make_shared<Generation>(*current);
+    const auto delta = CopyDeltaSegment(*generation);
+    delta->AddDocument(document_id, document, status, ratings);
+    ++generation->document_count_;
+    Publish(move(generation));
+}
+
+void ConcurrentSearchServer::AddDocuments(const vector<SearchServer::NewDocument>& documents) {
+    if (documents.empty()) {
+        return;
+    }
+    lock_guard guard(write_mutex_);
+    const auto current = GetGeneration();
+    for (const SearchServer::NewDocument& document : documents) {
+        if (current->FindSegment(document.id) != current->segments_.size()) {
+            throw invalid_argument("Document id is already taken");
+        }
+    }
+    auto generation = make_shared<Generation>(*current);
+    const auto delta = CopyDeltaSegment(*generation);
+    delta->AddDocuments(execution::par, documents);
+    generation->document_count_ += documents.size();
+    Publish(move(generation));
+}
+
+void ConcurrentSearchServer::RemoveDocument(int document_id) {
+    lock_guard guard(write_mutex_);
+    const auto current = GetGeneration();
+    const size_t segment_number = current->FindSegment(document_id);
+    if (segment_number == current->segments_.size()) {
+        return;
+    }
+    auto generation = make_shared<Generation>(*current);
+    Generation::Segment& segment = generation->segments_[segment_number];
+    if (segment_number + 1 == generation->segments_.size()) {
+        auto delta = make_shared<SearchServer>(*segment.index);
+        delta->RemoveDocument(document_id);
+        segment.index = move(delta);
+    } else {
+        auto tombstones = segment.tombstones ? make_shared<Generation::Tombstones>(*segment.tombstones)
+                                             : make_shared<Generation::Tombstones>();
+        const DocumentOrdinal ordinal = segment.index->GetDocumentOrdinal(document_id);
+        tombstones->removed_documents.Set(ordinal);
+        tombstones->removed_ids.push_back(document_id);
+        for (const auto& [word, freq] : segment.index->GetWordFrequencies(document_id)) {
+            ++tombstones->document_freqs[string(word)];
+        }
+        segment.tombstones = move(tombstones);
+    }
+    --generation->document_count_;
+    Publish(move(generation));
+}
+
+vector<Document> ConcurrentSearchServer::FindTopDocuments(string_view raw_query, DocumentStatus status, size_t max_result_count) const {
+    return GetGeneration()->FindTopDocuments(raw_query, status, max_result_count);
+}
+
+vector<Document> ConcurrentSearchServer::FindTopDocuments(string_view raw_query) const {
+    return GetGeneration()->FindTopDocuments(raw_query);
+}
+
+int ConcurrentSearchServer::GetDocumentCount() const {
+    return GetGeneration()->GetDocumentCount();
+}
+
+void ConcurrentSearchServer::WaitForMerges() {
+    unique_lock lock(merge_mutex_);
+    merge_condition_.wait(lock, [this]() {
+        return !is_merging_ && SelectMerge(*GetGeneration()).empty();
+    });
+}
+
+void ConcurrentSearchServer::Publish(shared_ptr<const Generation> generation) {
+    // The previous generation is released outside the lock
+    {
+        lock_guard guard(generation_mutex_);
+        generation_.swap(generation);
+    }
+    // Taking the mutex orders the publication before the merge thread checks for work
+    {
+        lock_guard guard(merge_mutex_);
+    }
+    merge_condition_.notify_all();
+}
+
+shared_ptr<SearchServer> ConcurrentSearchServer::CopyDeltaSegment(Generation& generation) const {
+    Generation::Segment& delta = generation.segments_.back();
+    if (delta.index->GetDocumentCount() >= MAX_DELTA_DOCUMENT_COUNT) {
+        auto segment = make_shared<SearchServer>(empty_segment_);
+        generation.segments_.push_back({segment, nullptr});
+        return segment;
+    }
+    auto segment = make_shared<SearchServer>(*delta.index);
+    delta.index = segment;
+    return segment;
+}
+
+vector<size_t> ConcurrentSearchServer::SelectMerge(const Generation& generation) {
+    const size_t immutable_count = generation.segments_.size() - 1;
+    // Segments with at least half of the documents removed are rewritten alone
+    for (size_t segment_number = 0; segment_number < immutable_count; ++segment_number) {
+        const Generation::Segment& segment = generation.segments_[segment_number];
+        if (segment.tombstones && segment.tombstones->removed_ids.size() * 2 >= static_cast<size_t>(segment.index->GetDocumentCount())) {
+            return {segment_number};
+        }
+    }
+    // Tier t holds segments of up to MAX_DELTA_DOCUMENT_COUNT * MERGE_FACTOR^t documents, so every document
+    // is merged about log(N) times and the segment count stays logarithmic
+    map<int, vector<size_t>> tiers;
+    for (size_t segment_number = 0; segment_number < immutable_count; ++segment_number) {
+        const int document_count = generation.segments_[segment_number].GetDocumentCount();
+        int tier = 0;
+        for (int64_t tier_size = MAX_DELTA_DOCUMENT_COUNT; document_count > tier_size; tier_size *= MERGE_FACTOR) {
+            ++tier;
+        }
+        vector<size_t>& tier_segments = tiers[tier];
+        tier_segments.push_back(segment_number);
+        if (tier_segments.size() == MERGE_FACTOR) {
+            return tier_segments;
+        }
+    }
+    return {};
+}
+
+void ConcurrentSearchServer::RunMerges() {
+    unique_lock lock(merge_mutex_);
+    while (true) {
+        merge_condition_.wait(lock, [this]() {
+            return is_stopping_ || !SelectMerge(*GetGeneration()).empty();
+        });
+        if (is_stopping_) {
+            return;
+        }
+        is_merging_ = true;
+        lock.unlock();
+        MergeSegments();
+        lock.lock();
+        is_merging_ = false;
+        merge_condition_.notify_all();
+    }
+}
+
+void ConcurrentSearchServer::MergeSegments() {
+    const auto source = GetGeneration();
+    const vector<size_t> segment_numbers = SelectMerge(*source);
+    if (segment_numbers.empty()) {
+        return;
+    }
+    vector<Generation::Segment> merged_segments;
+    vector<SearchServer::NewDocument> documents;
+    for (const size_t segment_number : segment_numbers) {
+        const Generation::Segment& segment = source->segments_[segment_number];
+        merged_segments.push_back(segment);
+        for (const int document_id : *segment.index) {
+            if (!segment.IsRemoved(document_id)) {
+                documents.push_back(segment.index->GetDocument(document_id));
+            }
+        }
+    }
+    // Texts of the documents view the source segments, which the source generation keeps alive
+    auto merged = make_shared<SearchServer>(empty_segment_);
+    merged->AddDocuments(execution::par, documents);
+    merged->SetPostingFormat(PostingFormat::COMPRESSED);
+
+    lock_guard guard(write_mutex_);
+    const auto current = GetGeneration();
+    const auto is_merged = [&merged_segments](const Generation::Segment& segment) {
+        return any_of(merged_segments.begin(), merged_segments.end(), [&segment](const Generation::Segment& merged_segment) {
+            return merged_segment.index == segment.index;
+        });
+    };
+    // Only the merge thread drops immutable segments, but writers may have added tombstones to them meanwhile
+    for (const Generation::Segment& merged_segment : merged_segments) {
+        const size_t merged_removal_count = merged_segment.tombstones ? merged_segment.tombstones->removed_ids.size() : 0;
+        for (const Generation::Segment& segment : current->segments_) {
+            if (segment.index != merged_segment.index || segment.tombstones == nullptr) {
+                continue;
+            }
+            for (size_t i = merged_removal_count; i < segment.tombstones->removed_ids.size(); ++i) {
+                merged->RemoveDocument(segment.tombstones->removed_ids[i]);
+            }
+        }
+    }
+
+    auto generation = make_shared<Generation>();
+    generation->document_count_ = current->document_count_;
+    bool is_merged_placed = false;
+    for (const Generation::Segment& segment : current->segments_) {
+        if (!is_merged(segment)) {
+            generation->segments_.push_back(segment);
+        } else if (!is_merged_placed) {
+            is_merged_placed = true;
+            if (merged->GetDocumentCount() > 0) {
+                generation->segments_.push_back({merged, nullptr});
+            }
+        }
+    }
+    Publish(move(generation));
+}
+
+vector<Document> ConcurrentSearchServer::Generation::FindTopDocuments(string_view raw_query, DocumentStatus status,
+                                                                      size_t max_result_count) const {
+    return FindTopDocuments(raw_query, StatusFilter{status}, max_result_count);
+}
+
+vector<Document> ConcurrentSearchServer::Generation::FindTopDocuments(string_view raw_query) const {
+    return FindTopDocuments(raw_query, DocumentStatus::ACTUAL);
+}
+
+SearchServer::MatchDocumentResult ConcurrentSearchServer::Generation::MatchDocument(string_view raw_query, int document_id) const {
+    const size_t segment_number = FindSegment(document_id);
+    // The delta segment never holds tombstones, so a missing document is reported by it after the query is checked
+    const Segment& segment = segment_number == segments_.size() ? segments_.back() : segments_[segment_number];
+    return segment.index->MatchDocument(raw_query, document_id);
+}
+
+int ConcurrentSearchServer::Generation::GetDocumentCount() const {
+    return document_count_;
+}
+
+bool ConcurrentSearchServer::Generation::HasDocument(int document_id) const {
+    return FindSegment(document_id) != segments_.size();
+}
+
+size_t ConcurrentSearchServer::Generation::GetSegmentCount() const {
+    return segments_.size();
+}
+
+bool ConcurrentSearchServer::Generation::Segment::IsRemoved(int document_id) const {
+    if (tombstones == nullptr) {
+        return false;
+    }
+    const DocumentOrdinal ordinal = index->GetDocumentOrdinal(document_id);
+    return tombstones->removed_documents.Test(ordinal);
+}
+
+int ConcurrentSearchServer::Generation::Segment::GetDocumentCount() const {
+    return index->GetDocumentCount() - (tombstones ? tombstones->removed_ids.size() : 0);
+}
+
+size_t ConcurrentSearchServer::Generation::FindSegment(int document_id) const {
+    for (size_t segment_number = 0; segment_number < segments_.size(); ++segment_number) {
+        const Segment& segment = segments_[segment_number];
+        if (segment.index->HasDocument(document_id) && !segment.IsRemoved(document_id)) {
+            return segment_number;
+        }
+    }
+    return segments_.size();
+}
+
+CollectionStatistics ConcurrentSearchServer::Generation::CollectStatistics(string_view raw_query) const {
+    CollectionStatistics statistics;
+    for (const Segment& segment : segments_) {
+        segment.index->CollectStatistics(raw_query, statistics);
+        if (segment.tombstones == nullptr) {
+            continue;
+        }
+        // word_count still counts the removed documents, only BM25 reads it and segments rank with TF-IDF
+        statistics.document_count -= segment.tombstones->removed_ids.size();
+        for (auto& [word, document_freq] : statistics.document_freqs) {
+            if (const auto it = segment.tombstones->document_freqs.find(word); it != segment.tombstones->document_freqs.end()) {
+                document_freq -= it->second;
+            }
+        }
+    }
+    return statistics;
+}
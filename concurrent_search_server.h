@@ -0,0 +1,153 @@
+#pragma once
+
+#include "search_server.h"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Search server whose queries never wait for ingestion. Queries run against an immutable index generation,
+// and every write publishes a new generation atomically. Generations share their segments: a write copies
+// only the small delta segment, and documents removed from older segments are hidden by tombstones.
+// A background thread merges immutable segments of similar size and purges removed documents from them
+class ConcurrentSearchServer {
+public:
+    // Once the delta segment holds this many documents it stays immutable and new documents go to a fresh one
+    static constexpr int MAX_DELTA_DOCUMENT_COUNT = 1024;
+    // Number of immutable segments of one size tier that are merged together
+    static constexpr size_t MERGE_FACTOR = 4;
+
+    class Generation;
+
+    template <typename StringContainer>
+    explicit ConcurrentSearchServer(const StringContainer& stop_words);
+    explicit ConcurrentSearchServer(const std::string& stop_words_text);
+    explicit ConcurrentSearchServer(std::string_view stop_words_text);
+    ~ConcurrentSearchServer();
+
+    // The current generation, it never changes and stays usable for as long as it is held
+    std::shared_ptr<const Generation> GetGeneration() const;
+
+    // Writers are serialized with each other, queries of the current generation run alongside them.
+    // A batch costs one copy of the delta segment, prefer it to many single additions
+    void AddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
+    void AddDocuments(const std::vector<SearchServer::NewDocument>& documents);
+    void RemoveDocument(int document_id);
+
+    // Blocks until no segment of the current generation needs merging
+    void WaitForMerges();
+
+    // Shortcuts for queries of the current generation
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate,
+                                           size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status,
+                                           size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    std::vector<Document> FindTopDocuments(std::string_view raw_query) const;
+    int GetDocumentCount() const;
+
+private:
+    const SearchServer empty_segment_;  // Validated stop words, new segments are copies of it
+    std::mutex write_mutex_;
+    // Held only to copy or swap the pointer, so queries never wait for more than a reference count update
+    mutable std::mutex generation_mutex_;
+    std::shared_ptr<const Generation> generation_;
+
+    std::mutex merge_mutex_;
+    std::condition_variable merge_condition_;  // Signals new generations and finished merges
+    bool is_merging_ = false;
+    bool is_stopping_ = false;
+    std::thread merge_thread_;
+
+    void Publish(std::shared_ptr<const Generation> generation);
+    // Copy of the current delta segment, or a new one if it is full
+    std::shared_ptr<SearchServer> CopyDeltaSegment(Generation& generation) const;
+
+    // Numbers of the immutable segments to merge next, empty if there is nothing to do
+    static std::vector<size_t> SelectMerge(const Generation& generation);
+    void RunMerges();
+    // Builds the merged segment without blocking writers, then publishes it with the removals made meanwhile
+    void MergeSegments();
+};
+
+// Immutable view of the whole index. Results match a single SearchServer holding the same documents
+class ConcurrentSearchServer::Generation {
+public:
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate,
+                                           size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status,
+                                           size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    std::vector<Document> FindTopDocuments(std::string_view raw_query) const;
+
+    // Matched words view the generation and are valid while it is held
+    SearchServer::MatchDocumentResult MatchDocument(std::string_view raw_query, int document_id) const;
+
+    int GetDocumentCount() const;
+    bool HasDocument(int document_id) const;
+    size_t GetSegmentCount() const;
+
+private:
+    friend class ConcurrentSearchServer;
+
+    // Documents that are removed but still indexed by an immutable segment
+    struct Tombstones {
+        SearchServer::DocumentMask removed_documents;
+        std::vector<int> removed_ids;  // In the order of removal
+        std::unordered_map<std::string, int> document_freqs;  // Removed documents containing a word
+    };
+
+    struct Segment {
+        std::shared_ptr<const SearchServer> index;
+        std::shared_ptr<const Tombstones> tombstones;  // Null while nothing is removed
+
+        bool IsRemoved(int document_id) const;
+        int GetDocumentCount() const;
+    };
+
+    // The last segment is the delta one, writers replace it with an updated copy instead of adding tombstones
+    std::vector<Segment> segments_;
+    int document_count_ = 0;
+
+    // Number of the segment holding the live document, or segments_.size()
+    size_t FindSegment(int document_id) const;
+    CollectionStatistics CollectStatistics(std::string_view raw_query) const;
+};
+
+template <typename StringContainer>
+ConcurrentSearchServer::ConcurrentSearchServer(const StringContainer& stop_words)
+    : empty_segment_(stop_words) {
+    auto generation = std::make_shared<Generation>();
+    generation->segments_.push_back({std::make_shared<const SearchServer>(empty_segment_), nullptr});
+    generation_ = std::move(generation);
+    merge_thread_ = std::thread([this]() {
+        RunMerges();
+    });
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> ConcurrentSearchServer::FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate,
+                                                               size_t max_result_count) const {
+    return GetGeneration()->FindTopDocuments(raw_query, document_predicate, max_result_count);
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> ConcurrentSearchServer::Generation::FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate,
+                                                                           size_t max_result_count) const {
+    const CollectionStatistics statistics = CollectStatistics(raw_query);
+    TopDocuments top_documents(max_result_count);
+    for (const Segment& segment : segments_) {
+        const SearchServer::DocumentMask* removed_documents = segment.tombstones ? &segment.tombstones->removed_documents : nullptr;
+        const auto segment_documents = segment.index->FindTopDocuments(statistics, removed_documents, raw_query, document_predicate,
+                                                                       max_result_count);
+        for (const Document& document : segment_documents) {
+            top_documents.Push(document);
+        }
+    }
+    return top_documents.ExtractSorted();
+}
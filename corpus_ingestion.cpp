@@ -0,0 +1,430 @@
+#include "corpus_ingestion.h"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+using Clock = chrono::steady_clock;
+
+double GetSeconds(Clock::time_point start) {
+    return chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Queue between two stages. Push waits while the queue is full, Pop while it is empty. After Close the
+// items left are still popped; after Abort they are dropped and Push refuses new ones
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity)
+        : capacity_(max<size_t>(1, capacity)) {
+    }
+
+    // False if the queue is closed, the item is dropped then
+    bool Push(T item) {
+        unique_lock lock(mutex_);
+        not_full_.wait(lock, [this]() {
+            return is_closed_ || items_.size() < capacity_;
+        });
+        if (is_closed_) {
+            return false;
+        }
+        items_.push_back(move(item));
+        not_empty_.notify_one();
+        return true;
+    }
+
+    // Nothing once the queue is closed and empty
+    optional<T> Pop() {
+        unique_lock lock(mutex_);
+        not_empty_.wait(lock, [this]() {
+            return is_closed_ || !items_.empty();
+        });
+        if (items_.empty()) {
+            return nullopt;
+        }
+        T item = move(items_.front());
+        items_.pop_front();
+        not_full_.notify_one();
+        return item;
+    }
+
+    void Close() {
+        lock_guard guard(mutex_);
+        is_closed_ = true;
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+
+    void Abort() {
+        lock_guard guard(mutex_);
+        is_closed_ = true;
+        items_.clear();
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+
+private:
+    const size_t capacity_;
+    mutex mutex_;
+    condition_variable not_full_;
+    condition_variable not_empty_;
+    deque<T> items_;
+    bool is_closed_ = false;
+};
+
+// Whole lines of the corpus. storage keeps the bytes alive until the chunk is indexed
+struct Chunk {
+    shared_ptr<const void> storage;
+    string_view data;
+    uint64_t offset = 0;  // Of data in the corpus
+};
+
+struct ParsedChunk {
+    shared_ptr<const void> storage;
+    vector<SearchServer::NewDocument> documents;
+};
+
+struct TokenizedChunk {
+    shared_ptr<const void> storage;
+    SearchServer::TokenizedBatch batch;
+};
+
+class MappedFile {
+public:
+    explicit MappedFile(const string& path) {
+        const int descriptor = open(path.c_str(), O_RDONLY);
+        if (descriptor < 0) {
+            throw runtime_error("Cannot open corpus "s + path);
+        }
+        struct stat file_stat;
+        if (fstat(descriptor, &file_stat) != 0) {
+            close(descriptor);
+            throw runtime_error("Cannot read corpus "s + path);
+        }
+        size_ = static_cast<size_t>(file_stat.st_size);
+        // An empty file cannot be mapped and has no documents anyway
+        if (size_ > 0) {
+            void* const data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, descriptor, 0);
+            if (data == MAP_FAILED) {
+                close(descriptor);
+                throw runtime_error("Cannot map corpus "s + path);
+            }
+            data_ = static_cast<const char*>(data);
+            madvise(data, size_, MADV_SEQUENTIAL);
+        }
+        close(descriptor);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (data_ != nullptr) {
+            munmap(const_cast<char*>(data_), size_);
+        }
+    }
+
+    string_view GetData() const {
+        return {data_, size_};
+    }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// Line numbers start from 1 and count empty lines as well
+[[noreturn]] void ThrowMalformedRecord(uint64_t line_number, uint64_t offset, const string& reason) {
+    throw invalid_argument("Malformed record on line "s + to_string(line_number) + " at byte "s + to_string(offset)
+                           + ": "s + reason);
+}
+
+// Splits off the text up to the next tab
+string_view TakeField(string_view& line) {
+    const size_t tab = line.find('\t');
+    if (tab == string_view::npos) {
+        const string_view field = line;
+        line = {};
+        return field;
+    }
+    const string_view field = line.substr(0, tab);
+    line.remove_prefix(tab + 1);
+    return field;
+}
+
+bool ParseInt(string_view text, int& value) {
+    const auto [end, error] = from_chars(text.data(), text.data() + text.size(), value);
+    return error == errc() && end == text.data() + text.size() && !text.empty();
+}
+
+bool ParseStatus(string_view text, DocumentStatus& status) {
+    if (text == "ACTUAL"sv) {
+        status = DocumentStatus::ACTUAL;
+    } else if (text == "IRRELEVANT"sv) {
+        status = DocumentStatus::IRRELEVANT;
+    } else if (text == "BANNED"sv) {
+        status = DocumentStatus::BANNED;
+    } else if (text == "REMOVED"sv) {
+        status = DocumentStatus::REMOVED;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+SearchServer::NewDocument ParseRecord(string_view line, uint64_t line_number, uint64_t offset) {
+    SearchServer::NewDocument document;
+    if (!ParseInt(TakeField(line), document.id)) {
+        ThrowMalformedRecord(line_number, offset, "invalid document id"s);
+    }
+    if (line.empty() || !ParseStatus(TakeField(line), document.status)) {
+        ThrowMalformedRecord(line_number, offset, "invalid status"s);
+    }
+    // Without this check the text of "id\tSTATUS\ttext" would be read as its ratings
+    if (line.find('\t') == string_view::npos) {
+        ThrowMalformedRecord(line_number, offset, "expected id, status, ratings and text separated by tabs"s);
+    }
+    string_view ratings = TakeField(line);
+    while (!ratings.empty()) {
+        const size_t space = ratings.find(' ');
+        const string_view rating = ratings.substr(0, space);
+        ratings.remove_prefix(space == string_view::npos ? ratings.size() : space + 1);
+        if (rating.empty()) {
+            continue;
+        }
+        if (!ParseInt(rating, document.ratings.emplace_back())) {
+            ThrowMalformedRecord(line_number, offset, "invalid rating"s);
+        }
+    }
+    document.text = line;
+    return document;
+}
+
+// line_number is the number of lines parsed so far, chunks are parsed in corpus order
+ParsedChunk ParseChunk(Chunk chunk, uint64_t& line_number) {
+    ParsedChunk parsed{move(chunk.storage), {}};
+    string_view data = chunk.data;
+    uint64_t offset = chunk.offset;
+    while (!data.empty()) {
+        const size_t end = data.find('\n');
+        string_view line = data.substr(0, end);
+        const size_t line_size = end == string_view::npos ? data.size() : end + 1;
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+        ++line_number;
+        if (!line.empty()) {
+            parsed.documents.push_back(ParseRecord(line, line_number, offset));
+        }
+        data.remove_prefix(line_size);
+        offset += line_size;
+    }
+    return parsed;
+}
+
+// Stages of one ingestion. Each runs on its own thread except for indexing, which stays on the calling one
+class IngestionPipeline {
+public:
+    IngestionPipeline(SearchServer& search_server, const IngestionOptions& options)
+        : search_server_(search_server)
+        , chunks_(options.max_queued_chunks)
+        , parsed_chunks_(options.max_queued_chunks)
+        , tokenized_chunks_(options.max_queued_chunks) {
+    }
+
+    // read(push) calls push for every chunk in corpus order and stops once it returns false. The time read
+    // waits in push is not counted as reading
+    template <typename Reader>
+    IngestionStatistics Run(Reader read) {
+        const Clock::time_point start = Clock::now();
+        thread reader([&]() {
+            RunStage(chunks_, [&]() {
+                const Clock::time_point read_start = Clock::now();
+                double wait_seconds = 0.0;
+                read([&](Chunk chunk) {
+                    statistics_.byte_count += chunk.data.size();
+                    const Clock::time_point wait_start = Clock::now();
+                    const bool is_pushed = chunks_.Push(move(chunk));
+                    wait_seconds += GetSeconds(wait_start);
+                    return is_pushed;
+                });
+                statistics_.read_seconds = GetSeconds(read_start) - wait_seconds;
+            });
+        });
+        thread parser([&]() {
+            RunStage(parsed_chunks_, [&]() {
+                uint64_t line_number = 0;
+                Forward(chunks_, parsed_chunks_, statistics_.parse_seconds, [&line_number](Chunk chunk) {
+                    return ParseChunk(move(chunk), line_number);
+                });
+            });
+        });
+        thread tokenizer([&]() {
+            RunStage(tokenized_chunks_, [&]() {
+                Forward(parsed_chunks_, tokenized_chunks_, statistics_.tokenize_seconds, [this](ParsedChunk parsed) {
+                    return TokenizedChunk{move(parsed.storage), search_server_.TokenizeDocuments(parsed.documents)};
+                });
+            });
+        });
+        try {
+            while (optional<TokenizedChunk> chunk = tokenized_chunks_.Pop()) {
+                const Clock::time_point index_start = Clock::now();
+                statistics_.document_count += chunk->batch.size();
+                search_server_.AddDocuments(execution::par, chunk->batch);
+                statistics_.index_seconds += GetSeconds(index_start);
+            }
+        } catch (...) {
+            Fail(current_exception());
+        }
+        reader.join();
+        parser.join();
+        tokenizer.join();
+        if (exception_) {
+            rethrow_exception(exception_);
+        }
+        statistics_.seconds = GetSeconds(start);
+        return statistics_;
+    }
+
+private:
+    SearchServer& search_server_;
+    BoundedQueue<Chunk> chunks_;
+    BoundedQueue<ParsedChunk> parsed_chunks_;
+    BoundedQueue<TokenizedChunk> tokenized_chunks_;
+    IngestionStatistics statistics_;  // Every field is written by a single stage
+    mutex exception_mutex_;
+    exception_ptr exception_;
+
+    // Closes the output of the stage once it is done, or stops the whole pipeline if it fails
+    template <typename Output, typename Function>
+    void RunStage(BoundedQueue<Output>& output, Function function) {
+        try {
+            function();
+            output.Close();
+        } catch (...) {
+            Fail(current_exception());
+        }
+    }
+
+    // Time spent waiting on the queues is not counted as work of the stage
+    template <typename Input, typename Output, typename Function>
+    static void Forward(BoundedQueue<Input>& input, BoundedQueue<Output>& output, double& seconds, Function function) {
+        while (optional<Input> item = input.Pop()) {
+            const Clock::time_point start = Clock::now();
+            Output result = function(move(*item));
+            seconds += GetSeconds(start);
+            if (!output.Push(move(result))) {
+                return;
+            }
+        }
+    }
+
+    void Fail(exception_ptr exception) {
+        {
+            lock_guard guard(exception_mutex_);
+            if (!exception_) {
+                exception_ = exception;
+            }
+        }
+        chunks_.Abort();
+        parsed_chunks_.Abort();
+        tokenized_chunks_.Abort();
+    }
+};
+
+}  // namespace
+
+double IngestionStatistics::GetDocumentsPerSecond() const {
+    return seconds > 0.0 ? document_count / seconds : 0.0;
+}
+
+double IngestionStatistics::GetMegabytesPerSecond() const {
+    return seconds > 0.0 ? byte_count / seconds / (1 << 20) : 0.0;
+}
+
+// The stream is read in blocks of chunk_size bytes. The bytes after the last line break of a block wait
+// for the next one, so a line longer than a block makes the chunk grow instead of being split
+IngestionStatistics IngestCorpus(SearchServer& search_server, istream& input, const IngestionOptions& options) {
+    const size_t chunk_size = max<size_t>(1, options.chunk_size);
+    IngestionPipeline pipeline(search_server, options);
+    return pipeline.Run([&](const auto& push) {
+        string carry;
+        uint64_t offset = 0;
+        while (true) {
+            auto buffer = make_shared<string>(move(carry));
+            carry.clear();
+            const size_t carry_size = buffer->size();
+            buffer->resize(carry_size + chunk_size);
+            input.read(buffer->data() + carry_size, static_cast<streamsize>(chunk_size));
+            buffer->resize(carry_size + static_cast<size_t>(input.gcount()));
+            if (input.bad()) {
+                throw runtime_error("Cannot read corpus"s);
+            }
+            const bool is_end = !input;
+            if (!is_end) {
+                const size_t line_end = buffer->rfind('\n');
+                if (line_end == string::npos) {
+                    carry = move(*buffer);
+                    continue;
+                }
+                carry.assign(*buffer, line_end + 1, string::npos);
+                buffer->resize(line_end + 1);
+            }
+            if (!buffer->empty()) {
+                const string_view data = *buffer;
+                const uint64_t chunk_offset = offset;
+                offset += data.size();
+                if (!push(Chunk{move(buffer), data, chunk_offset})) {
+                    return;
+                }
+            }
+            if (is_end) {
+                return;
+            }
+        }
+    });
+}
+
+// Chunks are views of the mapping, reading them is left to the page faults of the parser. The reader only
+// asks the kernel to load every chunk ahead of its parsing
+IngestionStatistics IngestCorpusFile(SearchServer& search_server, const string& path, const IngestionOptions& options) {
+    const auto file = make_shared<const MappedFile>(path);
+    const size_t chunk_size = max<size_t>(1, options.chunk_size);
+    const long page_size = sysconf(_SC_PAGESIZE);
+    IngestionPipeline pipeline(search_server, options);
+    return pipeline.Run([&](const auto& push) {
+        const string_view data = file->GetData();
+        size_t begin = 0;
+        while (begin < data.size()) {
+            size_t end = data.find('\n', min(data.size(), begin + chunk_size) - 1);
+            end = end == string_view::npos ? data.size() : end + 1;
+            const uintptr_t address = reinterpret_cast<uintptr_t>(data.data() + begin);
+            const uintptr_t page = address - address % page_size;
+            madvise(reinterpret_cast<void*>(page), end - begin + (address - page), MADV_WILLNEED);
+            if (!push(Chunk{file, data.substr(begin, end - begin), begin})) {
+                return;
+            }
+            begin = end;
+        }
+    });
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "search_server.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <string>
+
+// A corpus holds one document per line: id, status, ratings and text separated by tabs, e.g.
+// "17\tACTUAL\t5 -2 3\tfluffy cat". Status is ACTUAL, IRRELEVANT, BANNED or REMOVED, ratings are separated
+// by spaces. All four fields are required, a document without ratings keeps an empty field as in
+// "17\tACTUAL\t\tfluffy cat". The text takes the rest of the line. Empty lines are skipped
+struct IngestionOptions {
+    size_t chunk_size = size_t{1} << 20;  // Bytes read at once, rounded up to whole lines
+    size_t max_queued_chunks = 4;  // Chunks waiting between two stages
+};
+
+// Counts of an ingestion. Every stage runs on its own thread, a stage busier than the others bounds the throughput
+struct IngestionStatistics {
+    uint64_t document_count = 0;
+    uint64_t byte_count = 0;
+    double seconds = 0.0;
+    double read_seconds = 0.0;
+    double parse_seconds = 0.0;
+    double tokenize_seconds = 0.0;
+    double index_seconds = 0.0;
+
+    double GetDocumentsPerSecond() const;
+    double GetMegabytesPerSecond() const;
+};
+
+// Adds the documents of the corpus to the server. Chunks go through four stages connected by bounded queues:
+// reading, parsing the records, splitting the texts into words and indexing, so a chunk is read while the ones
+// before it are parsed and indexed. Every chunk is added with AddDocuments. The first error of a stage stops
+// the others and is rethrown: malformed records throw std::invalid_argument with their line and byte offset, documents
+// are rejected as by AddDocument. Chunks indexed before the error stay in the server
+IngestionStatistics IngestCorpus(SearchServer& search_server, std::istream& input, const IngestionOptions& options = {});
+
+// Same for a file, which is mapped into memory instead of being read. Throws std::runtime_error if it cannot be mapped
+IngestionStatistics IngestCorpusFile(SearchServer& search_server, const std::string& path, const IngestionOptions& options = {});
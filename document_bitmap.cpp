@@ -0,0 +1,43 @@
+#include "document_bitmap.h"
+
+#include <algorithm>
+
+using namespace std;
+
+void DocumentBitmap::Assign(size_t size, bool value) {
+    words_.assign((size + WORD_BITS - 1) / WORD_BITS, value ? ~uint64_t{0} : 0);
+    size_ = size;
+    if (value && size % WORD_BITS != 0) {
+        words_.back() = (uint64_t{1} << (size % WORD_BITS)) - 1;
+    }
+}
+
+DocumentBitmap& DocumentBitmap::operator|=(const DocumentBitmap& other) {
+    const size_t common = min(words_.size(), other.words_.size());
+    for (size_t i = 0; i < common; ++i) {
+        words_[i] |= other.words_[i];
+    }
+    // Bits of other past the size must not leak into the last word
+    if (common == words_.size() && size_ % WORD_BITS != 0 && !words_.empty()) {
+        words_.back() &= (uint64_t{1} << (size_ % WORD_BITS)) - 1;
+    }
+    return *this;
+}
+
+void DocumentBitmap::Subtract(const DocumentBitmap& other) {
+    const size_t common = min(words_.size(), other.words_.size());
+    for (size_t i = 0; i < common; ++i) {
+        words_[i] &= ~other.words_[i];
+    }
+}
+
+void DocumentBitmap::Resize(size_t size) {
+    const size_t word_count = (size + WORD_BITS - 1) / WORD_BITS;
+    if (word_count > words_.size()) {
+        if (word_count > words_.capacity()) {
+            words_.reserve(max(word_count, words_.capacity() * 2));
+        }
+        words_.resize(word_count, 0);
+    }
+    size_ = size;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "posting_list.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Dense set of document ordinals, one bit per ordinal. Ordinals past the size are not in the set
+class DocumentBitmap {
+public:
+    DocumentBitmap() = default;
+
+    // Makes the bitmap hold `size` bits equal to value, the memory is reused
+    void Assign(size_t size, bool value);
+    // Grows the bitmap as needed
+    void Set(DocumentOrdinal ordinal) {
+        if (ordinal >= size_) {
+            Resize(ordinal + 1);
+        }
+        words_[ordinal / WORD_BITS] |= uint64_t{1} << (ordinal % WORD_BITS);
+    }
+    void Reset(DocumentOrdinal ordinal) {
+        if (ordinal < size_) {
+            words_[ordinal / WORD_BITS] &= ~(uint64_t{1} << (ordinal % WORD_BITS));
+        }
+    }
+    bool Test(DocumentOrdinal ordinal) const {
+        return ordinal < size_ && (words_[ordinal / WORD_BITS] >> (ordinal % WORD_BITS) & 1) != 0;
+    }
+
+    // Adds every ordinal of other that fits into this bitmap
+    DocumentBitmap& operator|=(const DocumentBitmap& other);
+    // Removes every ordinal of other
+    void Subtract(const DocumentBitmap& other);
+
+    size_t size() const {
+        return size_;
+    }
+
+private:
+    static constexpr size_t WORD_BITS = 64;
+
+    std::vector<uint64_t> words_;
+    size_t size_ = 0;
+
+    // Geometric growth keeps Set amortized constant, new bits are clear
+    void Resize(size_t size);
+};
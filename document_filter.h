@@ -0,0 +1,40 @@
+#pragma once
+
+#include "document.h"
+
+// Filters of FindTopDocuments known to the server at compile time. Each of them is a usual predicate too,
+// but instead of being called for every candidate it is resolved to a cheaper check: a status filter
+// becomes a bitmap of the allowed documents, no filter is no check at all
+
+// Every document passes
+struct NoFilter {
+    bool operator()(int /*document_id*/, DocumentStatus /*status*/, int /*rating*/) const {
+        return true;
+    }
+};
+
+struct StatusFilter {
+    DocumentStatus status = DocumentStatus::ACTUAL;
+
+    bool operator()(int /*document_id*/, DocumentStatus document_status, int /*rating*/) const {
+        return document_status == status;
+    }
+};
+
+struct RatingAtLeast {
+    int rating = 0;
+
+    bool operator()(int /*document_id*/, DocumentStatus /*status*/, int document_rating) const {
+        return document_rating >= rating;
+    }
+};
+
+// Ids from first to last, both included
+struct DocumentIdRange {
+    int first = 0;
+    int last = 0;
+
+    bool operator()(int document_id, DocumentStatus /*status*/, int /*rating*/) const {
+        return first <= document_id && document_id <= last;
+    }
+};
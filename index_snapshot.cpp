@@ -0,0 +1,383 @@
+#include "index_snapshot.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+// The file is a header followed by sections aligned to SECTION_ALIGNMENT. Every number is stored in the
+// byte order of the writing machine, byte_order tells a foreign file apart
+const char SNAPSHOT_MAGIC[8] = {'S', 'R', 'C', 'H', 'I', 'D', 'X', '\0'};
+const uint32_t SNAPSHOT_VERSION = 2;
+const uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+const size_t SECTION_ALIGNMENT = 8;
+
+struct StringRef {
+    uint64_t offset;  // In the strings section
+    uint64_t size;
+};
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t postings_offset;  // Blocks of every term followed by their padded payload bytes
+    uint64_t postings_size;
+    uint64_t terms_offset;  // TermRecord per TermId
+    uint64_t term_count;
+    uint64_t documents_offset;  // DocumentRecord per ordinal, removed documents included
+    uint64_t document_count;
+    uint64_t forward_offset;  // Forward index entries of every document
+    uint64_t forward_count;
+    uint64_t stop_words_offset;  // StringRef per stop word
+    uint64_t stop_word_count;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+};
+
+struct TermRecord {
+    StringRef text;
+    uint64_t postings_offset;  // In the postings section
+    uint32_t block_count;
+    uint32_t document_freq;
+    PostingBound bound;
+};
+
+struct DocumentRecord {
+    int32_t id;  // -1 for a removed document
+    int32_t rating;
+    int32_t status;
+    uint32_t word_count;
+    uint64_t forward_begin;  // Index of the first forward entry
+    uint64_t term_count;
+    StringRef text;
+};
+
+// Forward index entries are stored exactly as SearchServer::TermCount is laid out
+struct ForwardEntry {
+    uint32_t term_id;
+    uint32_t count;
+};
+
+static_assert(is_trivially_copyable_v<CompressedPostingList::BlockInfo>);
+static_assert(sizeof(CompressedPostingList::BlockInfo) % SECTION_ALIGNMENT == 0);
+
+class SnapshotWriter {
+public:
+    explicit SnapshotWriter(const string& path)
+        : out_(path, ios::binary | ios::trunc) {
+        if (!out_) {
+            throw runtime_error("Cannot create index snapshot "s + path);
+        }
+    }
+
+    uint64_t GetPosition() const {
+        return position_;
+    }
+
+    void Write(const void* data, size_t size) {
+        out_.write(static_cast<const char*>(data), size);
+        position_ += size;
+    }
+
+    template <typename T>
+    void WriteValue(const T& value) {
+        Write(&value, sizeof(value));
+    }
+
+    void Align() {
+        static const char zeros[SECTION_ALIGNMENT] = {};
+        Write(zeros, (SECTION_ALIGNMENT - position_ % SECTION_ALIGNMENT) % SECTION_ALIGNMENT);
+    }
+
+    void WriteHeader(const SnapshotHeader& header) {
+        out_.seekp(0);
+        out_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    }
+
+    void Finish(const string& path) {
+        out_.close();
+        if (!out_) {
+            throw runtime_error("Cannot write index snapshot "s + path);
+        }
+    }
+
+private:
+    ofstream out_;
+    uint64_t position_ = 0;
+};
+
+// Read-only shared mapping of a whole file, pages are shared with every process mapping the same file
+class MappedFile {
+public:
+    explicit MappedFile(const string& path) {
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw runtime_error("Cannot open index snapshot "s + path);
+        }
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) != 0 || file_stat.st_size < static_cast<off_t>(sizeof(SnapshotHeader))) {
+            close(fd);
+            throw runtime_error("Index snapshot "s + path + " is truncated"s);
+        }
+        size_ = file_stat.st_size;
+        void* data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) {
+            throw runtime_error("Cannot map index snapshot "s + path);
+        }
+        data_ = static_cast<const uint8_t*>(data);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        munmap(const_cast<uint8_t*>(data_), size_);
+    }
+
+    const uint8_t* data() const {
+        return data_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+private:
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+void CheckSection(const MappedFile& file, uint64_t offset, uint64_t count, size_t item_size) {
+    if (offset % SECTION_ALIGNMENT != 0 || offset > file.size() || count > (file.size() - offset) / item_size) {
+        throw runtime_error("Index snapshot section is out of the file"s);
+    }
+}
+
+void CheckString(const SnapshotHeader& header, const StringRef& ref) {
+    if (ref.offset > header.strings_size || ref.size > header.strings_size - ref.offset) {
+        throw runtime_error("Index snapshot string is out of the file"s);
+    }
+}
+
+}  // namespace
+
+void SaveIndexSnapshot(const SearchServer& search_server, const string& path) {
+    SnapshotWriter writer(path);
+    SnapshotHeader header{};
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    writer.WriteValue(header);
+    writer.Align();
+
+    // Strings are written last, their offsets are known in advance
+    uint64_t strings_size = 0;
+    const auto add_string = [&strings_size](string_view text) {
+        const StringRef ref{strings_size, text.size()};
+        strings_size += text.size();
+        return ref;
+    };
+
+    const size_t term_count = search_server.terms_.size();
+    vector<TermRecord> terms(term_count);
+    header.postings_offset = writer.GetPosition();
+    vector<CompressedPostingList::BlockInfo> blocks;
+    vector<uint8_t> bytes;
+    for (size_t term_id = 0; term_id < term_count; ++term_id) {
+        blocks.clear();
+        bytes.clear();
+        if (search_server.posting_format_ == PostingFormat::COMPRESSED) {
+            search_server.compressed_postings_[term_id].ExportBlocks(blocks, bytes);
+        } else {
+            search_server.CompressPostings(search_server.postings_[term_id]).ExportBlocks(blocks, bytes);
+        }
+        terms[term_id] = {add_string(search_server.terms_[term_id]), writer.GetPosition() - header.postings_offset,
+                          static_cast<uint32_t>(blocks.size()), static_cast<uint32_t>(search_server.GetDocumentFreq(term_id)),
+                          search_server.GetPostingBound(term_id)};
+        writer.Write(blocks.data(), blocks.size() * sizeof(blocks[0]));
+        writer.Write(bytes.data(), bytes.size());
+        writer.Align();
+    }
+    header.postings_size = writer.GetPosition() - header.postings_offset;
+
+    header.terms_offset = writer.GetPosition();
+    header.term_count = term_count;
+    writer.Write(terms.data(), terms.size() * sizeof(terms[0]));
+
+    const size_t document_count = search_server.documents_.size();
+    header.documents_offset = writer.GetPosition();
+    header.document_count = document_count;
+    uint64_t forward_count = 0;
+    for (size_t ordinal = 0; ordinal < document_count; ++ordinal) {
+        const auto& document = search_server.documents_[ordinal];
+        const DocumentRecord record{document.id, document.rating, static_cast<int32_t>(document.status),
+                                    search_server.document_word_counts_[ordinal], forward_count,
+                                    search_server.GetDocumentTerms(ordinal).size(), add_string(search_server.GetDocumentText(ordinal))};
+        forward_count += record.term_count;
+        writer.WriteValue(record);
+    }
+
+    header.forward_offset = writer.GetPosition();
+    header.forward_count = forward_count;
+    for (size_t ordinal = 0; ordinal < document_count; ++ordinal) {
+        for (const auto& term : search_server.GetDocumentTerms(ordinal)) {
+            writer.WriteValue(ForwardEntry{term.term_id, term.count});
+        }
+    }
+
+    header.stop_words_offset = writer.GetPosition();
+    header.stop_word_count = search_server.stop_words_.size();
+    for (const string& stop_word : search_server.stop_words_) {
+        writer.WriteValue(add_string(stop_word));
+    }
+
+    header.strings_offset = writer.GetPosition();
+    header.strings_size = strings_size;
+    for (TermId term_id = 0; term_id < term_count; ++term_id) {
+        const string_view term = search_server.terms_[term_id];
+        writer.Write(term.data(), term.size());
+    }
+    for (size_t ordinal = 0; ordinal < document_count; ++ordinal) {
+        const string_view text = search_server.GetDocumentText(ordinal);
+        writer.Write(text.data(), text.size());
+    }
+    for (const string& stop_word : search_server.stop_words_) {
+        writer.Write(stop_word.data(), stop_word.size());
+    }
+
+    writer.WriteHeader(header);
+    writer.Finish(path);
+}
+
+SearchServer OpenIndexSnapshot(const string& path) {
+    const auto file = make_shared<const MappedFile>(path);
+    SnapshotHeader header;
+    memcpy(&header, file->data(), sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 || header.byte_order != SNAPSHOT_BYTE_ORDER) {
+        throw runtime_error("File "s + path + " is not an index snapshot"s);
+    }
+    if (header.version != SNAPSHOT_VERSION) {
+        throw runtime_error("Index snapshot "s + path + " has unsupported version "s + to_string(header.version));
+    }
+    CheckSection(*file, header.postings_offset, header.postings_size, 1);
+    CheckSection(*file, header.terms_offset, header.term_count, sizeof(TermRecord));
+    CheckSection(*file, header.documents_offset, header.document_count, sizeof(DocumentRecord));
+    CheckSection(*file, header.forward_offset, header.forward_count, sizeof(ForwardEntry));
+    CheckSection(*file, header.stop_words_offset, header.stop_word_count, sizeof(StringRef));
+    if (header.strings_offset > file->size() || header.strings_size > file->size() - header.strings_offset) {
+        throw runtime_error("Index snapshot section is out of the file"s);
+    }
+
+    const auto* strings = reinterpret_cast<const char*>(file->data() + header.strings_offset);
+    const auto get_string = [&header, strings](const StringRef& ref) {
+        CheckString(header, ref);
+        return string_view(strings + ref.offset, ref.size);
+    };
+
+    const auto* stop_word_refs = reinterpret_cast<const StringRef*>(file->data() + header.stop_words_offset);
+    vector<string_view> stop_words;
+    stop_words.reserve(header.stop_word_count);
+    for (size_t i = 0; i < header.stop_word_count; ++i) {
+        stop_words.push_back(get_string(stop_word_refs[i]));
+    }
+    SearchServer search_server(stop_words);
+    search_server.posting_format_ = PostingFormat::COMPRESSED;
+
+    using BlockInfo = CompressedPostingList::BlockInfo;
+    const uint8_t* postings = file->data() + header.postings_offset;
+    const auto* term_records = reinterpret_cast<const TermRecord*>(file->data() + header.terms_offset);
+    search_server.compressed_postings_.reserve(header.term_count);
+    search_server.terms_.reserve(header.term_count);
+    vector<SearchServer::WordSetFingerprint> term_fingerprints;
+    term_fingerprints.reserve(header.term_count);
+    search_server.term_log_document_freqs_.reserve(header.term_count);
+    if (header.document_count > numeric_limits<DocumentOrdinal>::max()) {
+        throw runtime_error("Index snapshot has too many documents"s);
+    }
+    const auto ordinal_end = static_cast<DocumentOrdinal>(header.document_count);
+    for (size_t term_id = 0; term_id < header.term_count; ++term_id) {
+        const TermRecord& record = term_records[term_id];
+        const uint64_t blocks_size = uint64_t{record.block_count} * sizeof(BlockInfo);
+        // Terms are written in order, the payload of a term ends where the next one starts
+        const uint64_t postings_end = term_id + 1 < header.term_count ? term_records[term_id + 1].postings_offset : header.postings_size;
+        if (record.postings_offset % SECTION_ALIGNMENT != 0 || postings_end > header.postings_size
+            || record.postings_offset > postings_end
+            || blocks_size + CompressedPostingList::PADDING_SIZE > postings_end - record.postings_offset) {
+            throw runtime_error("Index snapshot posting list is out of the file"s);
+        }
+        const string_view term = get_string(record.text);
+        if (!search_server.terms_.Intern(term).second) {
+            throw runtime_error("Index snapshot term dictionary is corrupted"s);
+        }
+        term_fingerprints.push_back(SearchServer::ComputeWordFingerprint(term));
+        search_server.term_log_document_freqs_.push_back(record.document_freq > 0 ? log(static_cast<double>(record.document_freq)) : 0.0);
+        const auto* blocks = reinterpret_cast<const BlockInfo*>(postings + record.postings_offset);
+        search_server.compressed_postings_.push_back(CompressedPostingList::FromBorrowedBlocks(
+            blocks, record.block_count, postings + record.postings_offset + blocks_size, record.document_freq, record.bound));
+        if (!search_server.compressed_postings_.back().IsValid(postings_end - record.postings_offset - blocks_size, ordinal_end)) {
+            throw runtime_error("Index snapshot posting list is corrupted"s);
+        }
+    }
+
+    static_assert(sizeof(ForwardEntry) == sizeof(SearchServer::TermCount));
+    const auto* forward_entries = reinterpret_cast<const SearchServer::TermCount*>(file->data() + header.forward_offset);
+    const auto* document_records = reinterpret_cast<const DocumentRecord*>(file->data() + header.documents_offset);
+    search_server.documents_.reserve(header.document_count);
+    search_server.document_word_counts_.reserve(header.document_count);
+    search_server.document_contents_.reserve(header.document_count);
+    search_server.document_fingerprints_.reserve(header.document_count);
+    search_server.document_ordinals_.reserve(header.document_count);
+    search_server.document_ids_.reserve(header.document_count);
+    // Texts and forward indexes stay in the mapping as borrowed arena chunks
+    const uint32_t text_chunk = search_server.document_texts_.AddBorrowedChunk(strings, header.strings_size);
+    const uint32_t terms_chunk = search_server.document_terms_.AddBorrowedChunk(forward_entries, header.forward_count);
+    for (size_t ordinal = 0; ordinal < header.document_count; ++ordinal) {
+        const DocumentRecord& record = document_records[ordinal];
+        CheckString(header, record.text);
+        if (record.forward_begin > header.forward_count || record.term_count > header.forward_count - record.forward_begin
+            || record.term_count > numeric_limits<uint32_t>::max() || record.text.size > numeric_limits<uint32_t>::max()) {
+            throw runtime_error("Index snapshot forward index is out of the file"s);
+        }
+        search_server.documents_.push_back({record.id, record.rating, static_cast<DocumentStatus>(record.status)});
+        search_server.document_word_counts_.push_back(record.word_count);
+        auto& content = search_server.document_contents_.emplace_back();
+        // Fingerprints are not stored, they are rebuilt from the forward index and the term hashes
+        auto& fingerprint = search_server.document_fingerprints_.emplace_back();
+        if (record.id != -1) {
+            for (uint64_t i = record.forward_begin; i < record.forward_begin + record.term_count; ++i) {
+                if (forward_entries[i].term_id >= header.term_count) {
+                    throw runtime_error("Index snapshot forward index is corrupted"s);
+                }
+                fingerprint ^= term_fingerprints[forward_entries[i].term_id];
+            }
+            search_server.document_ordinals_.emplace(record.id, ordinal);
+            search_server.word_count_ += record.word_count;
+            search_server.document_ids_.push_back(record.id);
+            if (static_cast<uint32_t>(record.status) < SearchServer::STATUS_COUNT) {
+                search_server.status_documents_[record.status].Set(ordinal);
+            }
+            content.text = {record.text.offset, text_chunk, static_cast<uint32_t>(record.text.size)};
+            content.terms = {record.forward_begin, terms_chunk, static_cast<uint32_t>(record.term_count)};
+        }
+    }
+    sort(search_server.document_ids_.begin(), search_server.document_ids_.end());
+
+    search_server.snapshot_ = file;
+    search_server.version_ = SearchServer::GetNextVersion();
+    return search_server;
+}
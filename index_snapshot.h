@@ -0,0 +1,16 @@
+#pragma once
+
+#include "search_server.h"
+
+#include <string>
+
+// Writes the whole index into a versioned binary file: stop words, term dictionary, posting lists
+// in the compressed block format, document metadata, forward indexes and texts.
+// Throws std::runtime_error if the file cannot be written
+void SaveIndexSnapshot(const SearchServer& search_server, const std::string& path);
+
+// Maps a file written by SaveIndexSnapshot read-only into memory. Posting lists, forward indexes and texts
+// are served from the mapped pages, only the term dictionary and per-document metadata are loaded.
+// The result uses PostingFormat::COMPRESSED and stays fully mutable: changed postings are copied out of the mapping.
+// Throws std::runtime_error if the file cannot be mapped or is not a snapshot of this version
+SearchServer OpenIndexSnapshot(const std::string& path);
@@ -0,0 +1,165 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+using namespace std;
+
+uint64_t HistogramSnapshot::GetPercentile(double percentile) const {
+    if (count == 0) {
+        return 0;
+    }
+    const auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(ceil(clamp(percentile, 0.0, 100.0) / 100.0 * count)));
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < bucket_counts.size(); ++bucket) {
+        seen += bucket_counts[bucket];
+        if (seen >= rank) {
+            return min(LatencyHistogram::GetBucketMax(bucket), max);
+        }
+    }
+    return max;
+}
+
+double HistogramSnapshot::GetMean() const {
+    return count == 0 ? 0.0 : static_cast<double>(sum) / count;
+}
+
+size_t LatencyHistogram::GetBucket(uint64_t nanoseconds) {
+    if (nanoseconds < SUB_BUCKET_COUNT) {
+        return nanoseconds;
+    }
+    size_t exponent = 63;
+    while ((nanoseconds >> exponent) == 0) {
+        --exponent;
+    }
+    const size_t shift = exponent - SUB_BUCKET_BITS;
+    return SUB_BUCKET_COUNT * (shift + 1) + ((nanoseconds >> shift) & (SUB_BUCKET_COUNT - 1));
+}
+
+uint64_t LatencyHistogram::GetBucketMax(size_t bucket) {
+    if (bucket < SUB_BUCKET_COUNT) {
+        return bucket;
+    }
+    const size_t shift = bucket / SUB_BUCKET_COUNT - 1;
+    const uint64_t first = (SUB_BUCKET_COUNT + bucket % SUB_BUCKET_COUNT) << shift;
+    return first + ((uint64_t{1} << shift) - 1);
+}
+
+void LatencyHistogram::Record(uint64_t nanoseconds) {
+    bucket_counts_[GetBucket(nanoseconds)].fetch_add(1, memory_order_relaxed);
+    sum_.fetch_add(nanoseconds, memory_order_relaxed);
+    uint64_t current_max = max_.load(memory_order_relaxed);
+    while (current_max < nanoseconds && !max_.compare_exchange_weak(current_max, nanoseconds, memory_order_relaxed)) {
+    }
+}
+
+void LatencyHistogram::AddTo(HistogramSnapshot& snapshot) const {
+    snapshot.bucket_counts.resize(BUCKET_COUNT, 0);
+    for (size_t bucket = 0; bucket < BUCKET_COUNT; ++bucket) {
+        const uint64_t count = bucket_counts_[bucket].load(memory_order_relaxed);
+        snapshot.bucket_counts[bucket] += count;
+        snapshot.count += count;
+    }
+    snapshot.sum += sum_.load(memory_order_relaxed);
+    snapshot.max = max(snapshot.max, max_.load(memory_order_relaxed));
+}
+
+void LatencyHistogram::Reset() {
+    for (auto& count : bucket_counts_) {
+        count.store(0, memory_order_relaxed);
+    }
+    sum_.store(0, memory_order_relaxed);
+    max_.store(0, memory_order_relaxed);
+}
+
+const HistogramSnapshot& SearchMetrics::Snapshot::GetPhase(SearchPhase phase) const {
+    return phases[static_cast<size_t>(phase)];
+}
+
+namespace {
+
+void WriteHistogramJson(ostream& out, const HistogramSnapshot& histogram) {
+    out << "{\"count\": " << histogram.count << ", \"mean_ns\": " << histogram.GetMean();
+    for (const auto& [name, percentile] : {pair{"p50", 50.0}, pair{"p90", 90.0}, pair{"p99", 99.0}, pair{"p999", 99.9}}) {
+        out << ", \"" << name << "_ns\": " << histogram.GetPercentile(percentile);
+    }
+    out << ", \"max_ns\": " << histogram.max << '}';
+}
+
+}  // namespace
+
+void SearchMetrics::Snapshot::WriteJson(ostream& out) const {
+    static const char* const phase_names[SEARCH_PHASE_COUNT] = {"parse", "filter", "traversal", "top_k", "result"};
+    out << "{\"queries\": " << query_count
+        << ", \"scanned_postings\": " << scanned_posting_count
+        << ", \"scored_documents\": " << scored_document_count
+        << ", \"empty_requests\": " << empty_request_count
+        << ", \"phases\": {";
+    for (size_t phase = 0; phase < SEARCH_PHASE_COUNT; ++phase) {
+        out << (phase > 0 ? ", \"" : "\"") << phase_names[phase] << "\": ";
+        WriteHistogramJson(out, phases[phase]);
+    }
+    out << "}, \"requests\": ";
+    WriteHistogramJson(out, requests);
+    out << '}';
+}
+
+SearchMetrics::SearchMetrics(size_t slot_count)
+    : slots_(new Slot[max<size_t>(1, slot_count)])
+    , slot_count_(max<size_t>(1, slot_count)) {
+}
+
+void SearchMetrics::RecordPhase(SearchPhase phase, uint64_t nanoseconds) {
+    GetSlot().phases[static_cast<size_t>(phase)].Record(nanoseconds);
+}
+
+void SearchMetrics::RecordRequest(uint64_t nanoseconds, bool is_empty) {
+    Slot& slot = GetSlot();
+    slot.requests.Record(nanoseconds);
+    if (is_empty) {
+        slot.empty_request_count.fetch_add(1, memory_order_relaxed);
+    }
+}
+
+void SearchMetrics::AddTraversalCounts(uint64_t scanned_posting_count, uint64_t scored_document_count) {
+    Slot& slot = GetSlot();
+    slot.scanned_posting_count.fetch_add(scanned_posting_count, memory_order_relaxed);
+    slot.scored_document_count.fetch_add(scored_document_count, memory_order_relaxed);
+}
+
+SearchMetrics::Snapshot SearchMetrics::GetSnapshot() const {
+    Snapshot snapshot;
+    for (size_t i = 0; i < slot_count_; ++i) {
+        const Slot& slot = slots_[i];
+        for (size_t phase = 0; phase < SEARCH_PHASE_COUNT; ++phase) {
+            slot.phases[phase].AddTo(snapshot.phases[phase]);
+        }
+        slot.requests.AddTo(snapshot.requests);
+        snapshot.query_count += slot.query_count.load(memory_order_relaxed);
+        snapshot.empty_request_count += slot.empty_request_count.load(memory_order_relaxed);
+        snapshot.scanned_posting_count += slot.scanned_posting_count.load(memory_order_relaxed);
+        snapshot.scored_document_count += slot.scored_document_count.load(memory_order_relaxed);
+    }
+    return snapshot;
+}
+
+void SearchMetrics::Reset() {
+    for (size_t i = 0; i < slot_count_; ++i) {
+        Slot& slot = slots_[i];
+        for (LatencyHistogram& histogram : slot.phases) {
+            histogram.Reset();
+        }
+        slot.requests.Reset();
+        slot.query_count.store(0, memory_order_relaxed);
+        slot.empty_request_count.store(0, memory_order_relaxed);
+        slot.scanned_posting_count.store(0, memory_order_relaxed);
+        slot.scored_document_count.store(0, memory_order_relaxed);
+    }
+}
+
+SearchMetrics::Slot& SearchMetrics::GetSlot() {
+    static atomic<size_t> next_thread_number{0};
+    thread_local const size_t thread_number = next_thread_number.fetch_add(1, memory_order_relaxed);
+    return slots_[thread_number % slot_count_];
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+// Phases of a search, timed separately
+enum class SearchPhase {
+    PARSE,      // Query parsing and term lookup
+    FILTER,     // Building the bitmap of excluded documents
+    TRAVERSAL,  // Posting traversal and scoring
+    TOP_K,      // Merging the tops of the ranges of a parallel search
+    RESULT,     // Sorting the top into the result
+};
+
+const size_t SEARCH_PHASE_COUNT = 5;
+
+// Counts of a latency histogram at one moment
+struct HistogramSnapshot {
+    std::vector<uint64_t> bucket_counts;
+    uint64_t count = 0;
+    uint64_t sum = 0;  // Nanoseconds
+    uint64_t max = 0;
+
+    // Highest value of the bucket holding the percentile, 0 for an empty histogram
+    uint64_t GetPercentile(double percentile) const;
+    double GetMean() const;
+};
+
+// Nanosecond latencies in log-linear buckets, as in HDR histograms: every power of two is split into
+// SUB_BUCKET_COUNT equal buckets, so a value is kept with a relative error below 1 / SUB_BUCKET_COUNT.
+// Recording is a few relaxed atomic additions and never blocks
+class LatencyHistogram {
+public:
+    static constexpr size_t SUB_BUCKET_BITS = 4;
+    static constexpr size_t SUB_BUCKET_COUNT = size_t{1} << SUB_BUCKET_BITS;
+    static constexpr size_t BUCKET_COUNT = SUB_BUCKET_COUNT * (64 - SUB_BUCKET_BITS + 1);
+
+    void Record(uint64_t nanoseconds);
+    // Adds the counts of the histogram to the snapshot
+    void AddTo(HistogramSnapshot& snapshot) const;
+    void Reset();
+
+    static size_t GetBucket(uint64_t nanoseconds);
+    static uint64_t GetBucketMax(size_t bucket);
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKET_COUNT> bucket_counts_{};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> max_{0};
+};
+
+// Metrics of searches and requests. Threads record into one of several slots chosen by the thread, so
+// concurrent searches rarely touch the same cache lines. Snapshots sum the slots while recording goes on
+class SearchMetrics {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Snapshot {
+        std::array<HistogramSnapshot, SEARCH_PHASE_COUNT> phases;
+        HistogramSnapshot requests;  // Whole RequestQueue requests
+        uint64_t query_count = 0;
+        uint64_t empty_request_count = 0;
+        uint64_t scanned_posting_count = 0;
+        uint64_t scored_document_count = 0;
+
+        const HistogramSnapshot& GetPhase(SearchPhase phase) const;
+        // One JSON object with the counters and, per histogram, its count, mean, percentiles and max
+        void WriteJson(std::ostream& out) const;
+    };
+
+    // Times the phases of one search and records them once it ends. Does nothing if metrics is null
+    class QueryTimer;
+
+    explicit SearchMetrics(size_t slot_count = std::thread::hardware_concurrency());
+
+    void RecordPhase(SearchPhase phase, uint64_t nanoseconds);
+    void RecordRequest(uint64_t nanoseconds, bool is_empty);
+    void AddTraversalCounts(uint64_t scanned_posting_count, uint64_t scored_document_count);
+
+    Snapshot GetSnapshot() const;
+    // Not synchronized with recording, values recorded meanwhile may survive it
+    void Reset();
+
+private:
+    struct alignas(64) Slot {
+        std::array<LatencyHistogram, SEARCH_PHASE_COUNT> phases;
+        LatencyHistogram requests;
+        std::atomic<uint64_t> query_count{0};
+        std::atomic<uint64_t> empty_request_count{0};
+        std::atomic<uint64_t> scanned_posting_count{0};
+        std::atomic<uint64_t> scored_document_count{0};
+    };
+
+    std::unique_ptr<Slot[]> slots_;
+    size_t slot_count_;
+
+    Slot& GetSlot();
+};
+
+class SearchMetrics::QueryTimer {
+public:
+    explicit QueryTimer(SearchMetrics* metrics)
+        : metrics_(metrics) {
+        if (metrics_ != nullptr) {
+            phase_start_ = Clock::now();
+        }
+    }
+
+    QueryTimer(const QueryTimer&) = delete;
+    QueryTimer& operator=(const QueryTimer&) = delete;
+
+    ~QueryTimer() {
+        if (metrics_ == nullptr) {
+            return;
+        }
+        metrics_->GetSlot().query_count.fetch_add(1, std::memory_order_relaxed);
+        for (size_t phase = 0; phase < SEARCH_PHASE_COUNT; ++phase) {
+            if (is_phase_ended_[phase]) {
+                metrics_->RecordPhase(static_cast<SearchPhase>(phase), phase_durations_[phase]);
+            }
+        }
+    }
+
+    // The time since the previous phase ended counts to this one, a phase may end several times
+    void EndPhase(SearchPhase phase) {
+        if (metrics_ == nullptr) {
+            return;
+        }
+        const Clock::time_point now = Clock::now();
+        const auto index = static_cast<size_t>(phase);
+        phase_durations_[index] += std::chrono::duration_cast<std::chrono::nanoseconds>(now - phase_start_).count();
+        is_phase_ended_[index] = true;
+        phase_start_ = now;
+    }
+
+private:
+    SearchMetrics* metrics_;
+    Clock::time_point phase_start_;
+    std::array<uint64_t, SEARCH_PHASE_COUNT> phase_durations_{};
+    std::array<bool, SEARCH_PHASE_COUNT> is_phase_ended_{};
+};
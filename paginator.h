@@ -1,7 +1,9 @@
 #pragma once
 #include <algorithm>
-#include <vector>
 #include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
 
 template <typename Iterator>
 class IteratorRange {
@@ -9,7 +11,7 @@ public:
     IteratorRange(Iterator begin, Iterator end)
         : first_(begin)
         , last_(end)
-        , size_(distance(first_, last_)) {
+        , size_(std::distance(first_, last_)) {
     }
 
     Iterator begin() const {
@@ -37,37 +39,104 @@ std::ostream& operator<<(std::ostream& out, const IteratorRange<Iterator>& range
     return out;
 }
 
+// Pages of a range, each computed when it is read. With random access iterators finding a page costs O(1)
+// whatever its number, other iterators walk to it
 template <typename Iterator>
 class Paginator {
 public:
-    Paginator(Iterator begin, Iterator end, size_t page_size) {
-        for (size_t left = distance(begin, end); left > 0;) {
-            const size_t current_page_size = std::min(page_size, left);
-            const Iterator current_page_end = next(begin, current_page_size);
-            pages_.push_back({begin, current_page_end});
-
-            left -= current_page_size;
-            begin = current_page_end;
+    using Page = IteratorRange<Iterator>;
+
+    class PageIterator {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = Page;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = Page;
+
+        Page operator*() const {
+            return {page_begin_, GetPageEnd()};
+        }
+
+        PageIterator& operator++() {
+            page_begin_ = GetPageEnd();
+            return *this;
+        }
+
+        bool operator==(const PageIterator& other) const {
+            return page_begin_ == other.page_begin_;
+        }
+
+        bool operator!=(const PageIterator& other) const {
+            return page_begin_ != other.page_begin_;
+        }
+
+    private:
+        friend class Paginator;
+
+        Iterator page_begin_;
+        Iterator end_;
+        size_t page_size_;
+
+        PageIterator(Iterator page_begin, Iterator end, size_t page_size)
+            : page_begin_(page_begin)
+            , end_(end)
+            , page_size_(page_size) {
+        }
+
+        Iterator GetPageEnd() const {
+            if constexpr (std::is_base_of_v<std::random_access_iterator_tag,
+                                            typename std::iterator_traits<Iterator>::iterator_category>) {
+                return std::next(page_begin_, std::min<size_t>(page_size_, end_ - page_begin_));
+            } else {
+                Iterator page_end = page_begin_;
+                for (size_t i = 0; i < page_size_ && page_end != end_; ++i) {
+                    ++page_end;
+                }
+                return page_end;
+            }
+        }
+    };
+
+    // Throws std::invalid_argument if page_size is 0
+    Paginator(Iterator begin, Iterator end, size_t page_size)
+        : begin_(begin)
+        , end_(end)
+        , page_size_(page_size)
+        , item_count_(std::distance(begin, end)) {
+        if (page_size_ == 0) {
+            throw std::invalid_argument("Page size must be positive");
         }
     }
 
-    auto begin() const {
-        return pages_.begin();
+    PageIterator begin() const {
+        return {begin_, end_, page_size_};
     }
 
-    auto end() const {
-        return pages_.end();
+    PageIterator end() const {
+        return {end_, end_, page_size_};
     }
 
     size_t size() const {
-        return pages_.size();
+        return (item_count_ + page_size_ - 1) / page_size_;
+    }
+
+    // Page number page_number, which must be less than size()
+    Page operator[](size_t page_number) const {
+        const size_t first_item = page_number * page_size_;
+        return {std::next(begin_, first_item), std::next(begin_, std::min(item_count_, first_item + page_size_))};
     }
 
 private:
-    std::vector<IteratorRange<Iterator>> pages_;
+    Iterator begin_;
+    Iterator end_;
+    size_t page_size_;
+    size_t item_count_;
 };
 
 template <typename Container>
 auto Paginate(const Container& c, size_t page_size) {
+    using std::begin;
+    using std::end;
     return Paginator(begin(c), end(c), page_size);
 }
\ No newline at end of file
@@ -0,0 +1,86 @@
+#include "posting_list.h"
+
+#include <algorithm>
+#include <cassert>
+
+using namespace std;
+
+void PostingList::Append(DocumentOrdinal ordinal, uint32_t term_count, uint32_t word_count) {
+    assert(ordinals_.empty() || ordinals_.back() < ordinal);
+    ordinals_.push_back(ordinal);
+    term_counts_.push_back(term_count);
+    bound_.Add(term_count, word_count);
+}
+
+bool PostingList::Erase(DocumentOrdinal ordinal) {
+    const auto it = lower_bound(ordinals_.begin(), ordinals_.end(), ordinal);
+    if (it == ordinals_.end() || *it != ordinal) {
+        return false;
+    }
+    term_counts_.erase(term_counts_.begin() + (it - ordinals_.begin()));
+    ordinals_.erase(it);
+    return true;
+}
+
+size_t PostingList::Erase(const DocumentOrdinal* first, const DocumentOrdinal* last, const uint32_t* word_counts) {
+    size_t kept = 0;
+    bound_ = {};
+    for (size_t i = 0; i < ordinals_.size(); ++i) {
+        while (first != last && *first < ordinals_[i]) {
+            ++first;
+        }
+        if (first != last && *first == ordinals_[i]) {
+            continue;
+        }
+        ordinals_[kept] = ordinals_[i];
+        term_counts_[kept] = term_counts_[i];
+        bound_.Add(term_counts_[i], word_counts[ordinals_[i]]);
+        ++kept;
+    }
+    const size_t erased = ordinals_.size() - kept;
+    ordinals_.resize(kept);
+    term_counts_.resize(kept);
+    return erased;
+}
+
+bool PostingList::Contains(DocumentOrdinal ordinal) const {
+    return binary_search(ordinals_.begin(), ordinals_.end(), ordinal);
+}
+
+void PostingList::Remap(const DocumentOrdinal* new_ordinals) {
+    for (DocumentOrdinal& ordinal : ordinals_) {
+        ordinal = new_ordinals[ordinal];
+    }
+    assert(is_sorted(ordinals_.begin(), ordinals_.end()));
+}
+
+const vector<DocumentOrdinal>& PostingList::GetOrdinals() const {
+    return ordinals_;
+}
+
+const vector<uint32_t>& PostingList::GetTermCounts() const {
+    return term_counts_;
+}
+
+const PostingBound& PostingList::GetBound() const {
+    return bound_;
+}
+
+void PostingList::UpdateBound(const uint32_t* word_counts) {
+    bound_ = {};
+    for (size_t i = 0; i < ordinals_.size(); ++i) {
+        bound_.Add(term_counts_[i], word_counts[ordinals_[i]]);
+    }
+}
+
+size_t PostingList::GetMemoryUsage() const {
+    return sizeof(*this) + ordinals_.capacity() * sizeof(DocumentOrdinal) + term_counts_.capacity() * sizeof(uint32_t);
+}
+
+size_t PostingList::size() const {
+    return ordinals_.size();
+}
+
+bool PostingList::empty() const {
+    return ordinals_.empty();
+}
\ No newline at end of file
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Dense number assigned to a document when it is added to the index.
+// Ordinals grow monotonically, so appending keeps every posting list sorted.
+using DocumentOrdinal = uint32_t;
+
+// Bounds of the postings of a list or of a block. Scorers derive the best score of any of them from it
+struct PostingBound {
+    double max_term_freq = 0.0;  // Of term count / document word count
+    uint32_t max_term_count = 0;
+    uint32_t min_word_count = std::numeric_limits<uint32_t>::max();
+
+    void Add(uint32_t term_count, uint32_t word_count) {
+        max_term_freq = std::max(max_term_freq, term_count * (1.0 / word_count));
+        max_term_count = std::max(max_term_count, term_count);
+        min_word_count = std::min(min_word_count, word_count);
+    }
+
+    // Whether erasing a posting may loosen the bound
+    bool IsReachedBy(uint32_t term_count, uint32_t word_count) const {
+        return term_count * (1.0 / word_count) >= max_term_freq || term_count >= max_term_count || word_count <= min_word_count;
+    }
+};
+
+// Postings of a single term stored column-wise: ordinals and term counts
+// live in two contiguous arrays sorted by ordinal
+class PostingList {
+public:
+    class Cursor;
+
+    // Ordinal must be greater than any ordinal already in the list, word_count is the one of the document
+    void Append(DocumentOrdinal ordinal, uint32_t term_count, uint32_t word_count);
+    bool Erase(DocumentOrdinal ordinal);
+    // Erases the postings of the sorted ordinals [first, last) in one pass, returns how many were found.
+    // word_counts maps ordinals to document word counts, the bound is exact afterwards
+    size_t Erase(const DocumentOrdinal* first, const DocumentOrdinal* last, const uint32_t* word_counts);
+    bool Contains(DocumentOrdinal ordinal) const;
+    // Replaces every ordinal with new_ordinals[ordinal]. The new ordinals must keep the postings in order
+    void Remap(const DocumentOrdinal* new_ordinals);
+
+    const std::vector<DocumentOrdinal>& GetOrdinals() const;
+    const std::vector<uint32_t>& GetTermCounts() const;
+    // Bound of the postings. Erasing a posting does not tighten it, UpdateBound makes it exact
+    const PostingBound& GetBound() const;
+    void UpdateBound(const uint32_t* word_counts);
+
+    size_t GetMemoryUsage() const;
+    size_t size() const;
+    bool empty() const;
+
+private:
+    std::vector<DocumentOrdinal> ordinals_;
+    std::vector<uint32_t> term_counts_;
+    PostingBound bound_;
+};
+
+// Forward-only iterator over postings with skipping, used by document-at-a-time evaluation
+class PostingList::Cursor {
+public:
+    // word_counts maps ordinals to document word counts and must outlive the cursor
+    Cursor(const PostingList& postings, const uint32_t* word_counts)
+        : ordinals_(postings.ordinals_.data())
+        , term_counts_(postings.term_counts_.data())
+        , word_counts_(word_counts)
+        , bound_(&postings.bound_)
+        , size_(postings.size()) {
+    }
+
+    // Only visits postings with ordinals in [range_begin, range_end)
+    Cursor(const PostingList& postings, const uint32_t* word_counts, DocumentOrdinal range_begin, DocumentOrdinal range_end)
+        : Cursor(postings, word_counts) {
+        const DocumentOrdinal* first = std::lower_bound(ordinals_, ordinals_ + size_, range_begin);
+        const DocumentOrdinal* last = std::lower_bound(first, ordinals_ + size_, range_end);
+        position_ = first - ordinals_;
+        size_ = last - ordinals_;
+    }
+
+    bool IsEnd() const {
+        return position_ == size_;
+    }
+
+    DocumentOrdinal GetOrdinal() const {
+        return ordinals_[position_];
+    }
+
+    uint32_t GetTermCount() const {
+        return term_counts_[position_];
+    }
+
+    uint32_t GetWordCount() const {
+        return word_counts_[ordinals_[position_]];
+    }
+
+    // Bound of the postings that may hold target. The list has no blocks, so it is the bound of the whole list
+    const PostingBound& GetBound(DocumentOrdinal) {
+        return *bound_;
+    }
+
+    void Next() {
+        ++position_;
+    }
+
+    // Moves to the first posting with ordinal >= target using galloping search
+    void Advance(DocumentOrdinal target) {
+        if (IsEnd() || ordinals_[position_] >= target) {
+            return;
+        }
+        size_t step = 1;
+        size_t low = position_;
+        size_t high = position_ + 1;
+        while (high < size_ && ordinals_[high] < target) {
+            low = high;
+            step *= 2;
+            high = std::min(position_ + step, size_);
+        }
+        // The answer lies in (low, high], high itself may be the first match
+        position_ = std::lower_bound(ordinals_ + low, ordinals_ + std::min(high + 1, size_), target) - ordinals_;
+    }
+
+private:
+    const DocumentOrdinal* ordinals_;
+    const uint32_t* term_counts_;
+    const uint32_t* word_counts_;
+    const PostingBound* bound_;
+    size_t size_;
+    size_t position_ = 0;
+};
\ No newline at end of file
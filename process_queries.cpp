@@ -1,25 +1,75 @@
 #include "process_queries.h"
 
 #include <algorithm>
-#include <execution>
+#include <mutex>
 
 using namespace std;
 
 vector<vector<Document>> ProcessQueries(const SearchServer& search_server, const vector<string>& queries) {
-    vector<vector<Document>> documents_lists(queries.size());
-    transform(
-        execution::par,
-        queries.begin(), queries.end(),
-        documents_lists.begin(),
-        [&search_server](const string& query) {
-            return search_server.FindTopDocuments(query);
+    return search_server.FindTopDocumentsBatch(queries);
+}
+
+vector<Document> ProcessQueriesJoined(const SearchServer& search_server, const vector<string>& queries) {
+    vector<Document> documents;
+    ProcessQueriesStreamed(search_server, queries, [&documents](size_t /*query_index*/, const vector<Document>& local_documents) {
+        documents.insert(documents.end(), local_documents.begin(), local_documents.end());
+    });
+    return documents;
+}
+
+// Queries run in windows of max_in_flight_queries. Whichever thread finishes the next query in order
+// delivers it and every later one already done, so consumer calls are serialized without a thread of their own
+void ProcessQueriesStreamed(const SearchServer& search_server, const vector<string>& queries,
+                            const QueryResultConsumer& consumer, size_t max_in_flight_queries) {
+    max_in_flight_queries = max<size_t>(1, max_in_flight_queries);
+    vector<vector<Document>> window_results;
+    vector<char> is_ready;
+    mutex delivery_mutex;
+    for (size_t window_begin = 0; window_begin < queries.size(); window_begin += max_in_flight_queries) {
+        const size_t window_size = min(max_in_flight_queries, queries.size() - window_begin);
+        window_results.assign(window_size, {});
+        is_ready.assign(window_size, 0);
+        size_t next_delivery = 0;
+        bool is_delivering = false;
+        search_server.GetThreadPool().ParallelFor(window_size, 8, [&](size_t begin, size_t end) {
+            // Worker threads live across calls, so their contexts are warm after the first few queries
+            thread_local SearchServer::QueryContext context;
+            for (size_t i = begin; i < end; ++i) {
+                vector<Document> documents = search_server.FindTopDocuments(context, queries[window_begin + i]);
+                unique_lock lock(delivery_mutex);
+                window_results[i] = move(documents);
+                is_ready[i] = 1;
+                if (is_delivering) {
+                    continue;
+                }
+                // If the consumer throws, is_delivering stays set and nothing else is delivered
+                is_delivering = true;
+                while (next_delivery < window_size && is_ready[next_delivery]) {
+                    const vector<Document> delivered = move(window_results[next_delivery]);
+                    lock.unlock();
+                    consumer(window_begin + next_delivery, delivered);
+                    lock.lock();
+                    ++next_delivery;
+                }
+                is_delivering = false;
+            }
         });
+    }
+}
+
+vector<vector<Document>> ProcessQueries(QueryResultCache& result_cache, const vector<string>& queries) {
+    vector<vector<Document>> documents_lists(queries.size());
+    result_cache.GetSearchServer().GetThreadPool().ParallelFor(queries.size(), 8, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            documents_lists[i] = result_cache.FindTopDocuments(queries[i]);
+        }
+    });
     return documents_lists;
 }
 
-vector<Document> ProcessQueriesJoined(const SearchServer& search_server, const vector<string>& queries) {
+vector<Document> ProcessQueriesJoined(QueryResultCache& result_cache, const vector<string>& queries) {
     vector<Document> documents;
-    for (const auto& local_documents : ProcessQueries(search_server, queries)) {
+    for (const auto& local_documents : ProcessQueries(result_cache, queries)) {
         documents.insert(documents.end(), local_documents.begin(), local_documents.end());
     }
     return documents;
@@ -1,8 +1,28 @@
 #include "document.h"
+#include "query_result_cache.h"
 #include "search_server.h"
+#include <cstddef>
+#include <functional>
 #include <string>
 #include <vector>
 
+// Runs the queries as one batch, see SearchServer::FindTopDocumentsBatch
 std::vector<std::vector<Document>> ProcessQueries(const SearchServer& search_server, const std::vector<std::string>& queries);
 
-std::vector<Document> ProcessQueriesJoined(const SearchServer& search_server, const std::vector<std::string>& queries);
\ No newline at end of file
+// Results of all queries one after another. They are streamed into the joined vector, so the per-query
+// results are never all kept at once
+std::vector<Document> ProcessQueriesJoined(const SearchServer& search_server, const std::vector<std::string>& queries);
+
+// Receives the results of query number query_index, the documents are valid only during the call
+using QueryResultConsumer = std::function<void(size_t query_index, const std::vector<Document>& documents)>;
+
+// Calls consumer for every query in query order, as soon as the query and all the queries before it are done.
+// Consumer calls never overlap. At most max_in_flight_queries results wait for the consumer: a slow consumer
+// holds back the next queries. The first exception of a query or of the consumer stops the stream and is rethrown
+void ProcessQueriesStreamed(const SearchServer& search_server, const std::vector<std::string>& queries,
+                            const QueryResultConsumer& consumer, size_t max_in_flight_queries = 1024);
+
+// Same, served from the cache where possible
+std::vector<std::vector<Document>> ProcessQueries(QueryResultCache& result_cache, const std::vector<std::string>& queries);
+
+std::vector<Document> ProcessQueriesJoined(QueryResultCache& result_cache, const std::vector<std::string>& queries);
\ No newline at end of file
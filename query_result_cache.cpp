@@ -0,0 +1,72 @@
+#include "query_result_cache.h"
+
+#include <algorithm>
+#include <functional>
+
+using namespace std;
+
+QueryResultCache::QueryResultCache(const SearchServer& search_server, size_t capacity, size_t shard_count)
+    : search_server_(search_server)
+    , shard_capacity_(max<size_t>(1, capacity / max<size_t>(1, shard_count)))
+    , shards_(new Shard[max<size_t>(1, shard_count)])
+    , shard_count_(max<size_t>(1, shard_count)) {
+}
+
+vector<Document> QueryResultCache::FindTopDocuments(string_view raw_query, DocumentStatus status, size_t max_result_count) {
+    string key = search_server_.GetQueryKey(raw_query);
+    key += '\0';
+    key += to_string(static_cast<int>(status));
+    key += '\0';
+    key += to_string(max_result_count);
+    Shard& shard = shards_[hash<string>{}(key) % shard_count_];
+
+    {
+        lock_guard guard(shard.mutex);
+        Validate(shard);
+        if (const auto it = shard.positions.find(key); it != shard.positions.end()) {
+            shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+            ++hits_;
+            return it->second->documents;
+        }
+    }
+    ++misses_;
+    // Computed without the lock, concurrent misses of one query may both search
+    vector<Document> documents = search_server_.FindTopDocuments(raw_query, status, max_result_count);
+
+    lock_guard guard(shard.mutex);
+    Validate(shard);
+    if (shard.positions.count(key) == 0) {
+        shard.entries.push_front({move(key), documents});
+        shard.positions.emplace(shard.entries.front().key, shard.entries.begin());
+        if (shard.entries.size() > shard_capacity_) {
+            shard.positions.erase(shard.entries.back().key);
+            shard.entries.pop_back();
+        }
+    }
+    return documents;
+}
+
+const SearchServer& QueryResultCache::GetSearchServer() const {
+    return search_server_;
+}
+
+QueryResultCache::Statistics QueryResultCache::GetStatistics() const {
+    return {hits_.load(), misses_.load()};
+}
+
+void QueryResultCache::Clear() {
+    for (size_t i = 0; i < shard_count_; ++i) {
+        lock_guard guard(shards_[i].mutex);
+        shards_[i].positions.clear();
+        shards_[i].entries.clear();
+    }
+}
+
+void QueryResultCache::Validate(Shard& shard) const {
+    const uint64_t version = search_server_.GetVersion();
+    if (shard.version != version) {
+        shard.positions.clear();
+        shard.entries.clear();
+        shard.version = version;
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "document.h"
+#include "search_server.h"
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Concurrent LRU cache of FindTopDocuments results of one server. Entries are keyed by the canonical query
+// (see SearchServer::GetQueryKey), the status and the result count, so reordered or repeated words hit the
+// same entry. A shard drops all of its entries once the server version changes.
+// Predicate queries are not cached, the server must not change while a lookup runs
+class QueryResultCache {
+public:
+    static const size_t DEFAULT_SHARD_COUNT = 16;
+
+    struct Statistics {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+    };
+
+    // The capacity is split evenly between the shards, every shard keeps at least one entry
+    QueryResultCache(const SearchServer& search_server, size_t capacity, size_t shard_count = DEFAULT_SHARD_COUNT);
+
+    // Thread-safe, computes the results on a miss
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status = DocumentStatus::ACTUAL,
+                                           size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT);
+
+    const SearchServer& GetSearchServer() const;
+    Statistics GetStatistics() const;
+    void Clear();
+
+private:
+    struct Entry {
+        std::string key;
+        std::vector<Document> documents;
+    };
+    struct Shard {
+        std::mutex mutex;
+        std::list<Entry> entries;  // Most recently used first
+        std::unordered_map<std::string_view, std::list<Entry>::iterator> positions;  // Keys view the entries
+        uint64_t version = 0;
+    };
+
+    const SearchServer& search_server_;
+    const size_t shard_capacity_;
+    std::unique_ptr<Shard[]> shards_;
+    const size_t shard_count_;
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+
+    // Drops the entries of the shard if they were computed for another server version, shard must be locked
+    void Validate(Shard& shard) const;
+};
@@ -1,25 +1,116 @@
 #include "request_queue.h"
 
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+
+namespace {
+
+uint64_t PackBucket(int64_t minute, uint64_t count) {
+    return static_cast<uint64_t>(minute) << 32 | count;
+}
+
+int64_t GetBucketMinute(uint64_t bucket) {
+    return static_cast<int64_t>(bucket >> 32);
+}
+
+uint64_t GetBucketCount(uint64_t bucket) {
+    return bucket & numeric_limits<uint32_t>::max();
+}
+
+}  // namespace
+
 RequestQueue::RequestQueue(const SearchServer& search_server)
     : search_server_(search_server)
-    , no_results_requests_(0)
-    , current_time_(0) {
+    , start_time_(Clock::now()) {
+}
+
+RequestQueue::RequestQueue(QueryResultCache& result_cache)
+    : RequestQueue(result_cache.GetSearchServer()) {
+    result_cache_ = &result_cache;
+}
+
+future<vector<Document>> RequestQueue::AddFindRequestAsync(ThreadPool& thread_pool, string raw_query,
+                                                           DocumentStatus status) {
+    return thread_pool.Submit([this, raw_query = move(raw_query), status]() {
+        return AddFindRequest(raw_query, status);
+    });
+}
+
+future<vector<Document>> RequestQueue::AddFindRequestAsync(string raw_query, DocumentStatus status) {
+    return AddFindRequestAsync(ThreadPool::GetDefault(), move(raw_query), status);
 }
 
 int RequestQueue::GetNoResultRequests() const {
-    return no_results_requests_;
+    Sweep(GetMinute() - static_cast<int64_t>(WINDOW_MINUTES));
+    return static_cast<int>(max<int64_t>(0, no_result_count_.load()));
+}
+
+void RequestQueue::SetMetrics(SearchMetrics* metrics) {
+    metrics_ = metrics;
 }
 
-void RequestQueue::AddRequest(int results_num) {
-    ++current_time_;
-    while (!requests_.empty() && sec_in_day_ <= current_time_ - requests_.front().timestamp) {
-        if (0 == requests_.front().results) {
-            --no_results_requests_;
+RequestQueue::Clock::time_point RequestQueue::StartRequest() const {
+    return metrics_ != nullptr ? Clock::now() : Clock::time_point{};
+}
+
+void RequestQueue::AddRequest(size_t results_num, Clock::time_point start) {
+    if (metrics_ != nullptr) {
+        const auto duration = Clock::now() - start;
+        metrics_->RecordRequest(chrono::duration_cast<chrono::nanoseconds>(duration).count(), results_num == 0);
+    }
+    if (results_num == 0) {
+        AddNoResultRequest(GetMinute());
+    }
+}
+
+int64_t RequestQueue::GetMinute() const {
+    return chrono::duration_cast<chrono::minutes>(Clock::now() - start_time_).count();
+}
+
+void RequestQueue::AddNoResultRequest(int64_t minute) {
+    atomic<uint64_t>& bucket = buckets_[minute % WINDOW_MINUTES];
+    uint64_t current = bucket.load();
+    while (true) {
+        const int64_t bucket_minute = GetBucketMinute(current);
+        if (bucket_minute > minute) {
+            // A thread read the clock later and already reused the bucket, the minute is out of the window
+            return;
+        }
+        const uint64_t old_count = bucket_minute == minute ? 0 : GetBucketCount(current);
+        if (bucket.compare_exchange_weak(current, bucket_minute == minute ? current + 1 : PackBucket(minute, 1))) {
+            no_result_count_.fetch_add(1 - static_cast<int64_t>(old_count));
+            break;
         }
-        requests_.pop_front();
     }
-    requests_.push_back({current_time_, results_num});
-    if (0 == results_num) {
-        ++no_results_requests_;
+    // A sweep that passed the minute before the increment could not see it
+    if (minute <= swept_minute_.load()) {
+        ClearBucket(minute);
     }
-}
\ No newline at end of file
+}
+
+void RequestQueue::ClearBucket(int64_t minute) const {
+    atomic<uint64_t>& bucket = buckets_[minute % WINDOW_MINUTES];
+    uint64_t current = bucket.load();
+    while (GetBucketMinute(current) <= minute && GetBucketCount(current) > 0) {
+        if (bucket.compare_exchange_weak(current, PackBucket(GetBucketMinute(current), 0))) {
+            no_result_count_.fetch_sub(static_cast<int64_t>(GetBucketCount(current)));
+            return;
+        }
+    }
+}
+
+void RequestQueue::Sweep(int64_t last_minute) const {
+    int64_t swept_minute = swept_minute_.load();
+    while (swept_minute < last_minute) {
+        if (swept_minute_.compare_exchange_weak(swept_minute, last_minute)) {
+            // Clearing a bucket also clears the older minutes sharing it, so one ring is enough
+            const int64_t first_minute = max(swept_minute + 1, last_minute - static_cast<int64_t>(WINDOW_MINUTES) + 1);
+            for (int64_t minute = first_minute; minute <= last_minute; ++minute) {
+                ClearBucket(minute);
+            }
+            return;
+        }
+    }
+}
@@ -1,42 +1,80 @@
 #pragma once
-#include <deque>
+#include <array>
+#include <atomic>
+#include <future>
+#include "metrics.h"
+#include "query_result_cache.h"
 #include "search_server.h"
+#include "thread_pool.h"
 
+// Counts the requests without results over the last WINDOW_MINUTES minutes of wall-clock time.
+// Every minute has a bucket in a ring, requests update them with atomic operations only, so the queue can be
+// used from several threads at once. Set the metrics before the requests start
 class RequestQueue {
 public:
+    static constexpr size_t WINDOW_MINUTES = 1440;
+
     explicit RequestQueue(const SearchServer& search_server);
+    // Status queries go through the cache, predicate queries always reach the server
+    explicit RequestQueue(QueryResultCache& result_cache);
 
     template <typename DocumentPredicate>
     std::vector<Document> AddFindRequest(const std::string& raw_query, DocumentPredicate document_predicate) {
+        const auto start = StartRequest();
         const auto result = search_server_.FindTopDocuments(raw_query, document_predicate);
-        AddRequest(result.size());
+        AddRequest(result.size(), start);
         return result;
     }
 
     std::vector<Document> AddFindRequest(const std::string& raw_query, DocumentStatus status) {
-        const auto result = search_server_.FindTopDocuments(raw_query, status);
-        AddRequest(result.size());
+        const auto start = StartRequest();
+        const auto result = result_cache_ != nullptr ? result_cache_->FindTopDocuments(raw_query, status)
+                                                     : search_server_.FindTopDocuments(raw_query, status);
+        AddRequest(result.size(), start);
         return result;
     }
 
     std::vector<Document> AddFindRequest(const std::string& raw_query) {
-        const auto result = search_server_.FindTopDocuments(raw_query);
-        AddRequest(result.size());
+        const auto start = StartRequest();
+        const auto result = result_cache_ != nullptr ? result_cache_->FindTopDocuments(raw_query)
+                                                     : search_server_.FindTopDocuments(raw_query);
+        AddRequest(result.size(), start);
         return result;
     }
 
+    // Runs the request on the pool, the queue must outlive the future
+    std::future<std::vector<Document>> AddFindRequestAsync(ThreadPool& thread_pool, std::string raw_query,
+                                                           DocumentStatus status = DocumentStatus::ACTUAL);
+    std::future<std::vector<Document>> AddFindRequestAsync(std::string raw_query,
+                                                           DocumentStatus status = DocumentStatus::ACTUAL);
+
+    // Drops the minutes that left the window, each of them once over all calls
     int GetNoResultRequests() const;
 
+    // Requests record their latency and whether they found nothing, null stops recording.
+    // The metrics are not owned. Searches record their phases only through SearchServer::SetMetrics
+    void SetMetrics(SearchMetrics* metrics);
+
 private:
-    struct QueryResult {
-        uint64_t timestamp;
-        int results;
-    };
-    std::deque<QueryResult> requests_;
+    using Clock = SearchMetrics::Clock;
+
     const SearchServer& search_server_;
-    int no_results_requests_;
-    uint64_t current_time_;
-    const static int sec_in_day_ = 1440;
+    QueryResultCache* result_cache_ = nullptr;
+    SearchMetrics* metrics_ = nullptr;
+    const Clock::time_point start_time_;
+    // Minute since start_time_ << 32 | requests without results in that minute, minute % WINDOW_MINUTES is
+    // the bucket of a minute. A bucket holding an older minute counts as empty once it is replaced or swept
+    mutable std::array<std::atomic<uint64_t>, WINDOW_MINUTES> buckets_{};
+    mutable std::atomic<int64_t> no_result_count_{0};  // Sum of the counts in the buckets
+    mutable std::atomic<int64_t> swept_minute_{-1};  // The buckets of this minute and all before it are empty
 
-    void AddRequest(int results_num);
-};
\ No newline at end of file
+    // Start of a request, read from the clock only if metrics are recorded
+    Clock::time_point StartRequest() const;
+    void AddRequest(size_t results_num, Clock::time_point start);
+    int64_t GetMinute() const;
+    void AddNoResultRequest(int64_t minute);
+    // Empties the bucket of the minute if it holds that minute or an older one
+    void ClearBucket(int64_t minute) const;
+    // Empties the minutes up to and including last_minute
+    void Sweep(int64_t last_minute) const;
+};
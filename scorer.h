@@ -0,0 +1,87 @@
+#pragma once
+
+#include "posting_list.h"
+
+#include <cmath>
+#include <cstdint>
+
+// Ranking functions of SearchServer, each implemented by a scorer below
+enum class RankingFunction {
+    TF_IDF,
+    BM25,
+};
+
+struct RankingOptions {
+    RankingFunction function = RankingFunction::TF_IDF;
+    // BM25 saturation of the term count and strength of the document length normalization
+    double k1 = 1.2;
+    double b = 0.75;
+};
+
+// Collection-wide counts of a query term
+struct TermStatistics {
+    double document_count = 0.0;  // Live documents
+    double document_freq = 0.0;  // Live documents containing the term
+    double log_document_count = 0.0;
+    double log_document_freq = 0.0;
+};
+
+// Scorers are compile-time policies of the document evaluation. A scorer weighs every query term once, then
+// scores its postings from the term count and the word count of the document. Scores must not decrease with
+// the term count nor grow with the word count: the upper bound of a posting list is the score of its bound
+
+// Term frequency times inverse document frequency
+class TfIdfScorer {
+public:
+    TfIdfScorer(const RankingOptions&, double) {
+    }
+
+    double GetTermWeight(const TermStatistics& statistics) const {
+        return statistics.log_document_count - statistics.log_document_freq;
+    }
+
+    double Score(double term_weight, uint32_t term_count, uint32_t word_count) const {
+        return term_count * (1.0 / word_count) * term_weight;
+    }
+
+    double GetUpperBound(double term_weight, const PostingBound& bound) const {
+        return bound.max_term_freq * term_weight;
+    }
+};
+
+// Okapi BM25 with the non-negative inverse document frequency of Lucene
+class Bm25Scorer {
+public:
+    Bm25Scorer(const RankingOptions& options, double average_word_count)
+        : saturation_(options.k1 + 1.0)
+        , length_base_(options.k1 * (1.0 - options.b))
+        , length_factor_(average_word_count > 0.0 ? options.k1 * options.b / average_word_count : 0.0) {
+    }
+
+    double GetTermWeight(const TermStatistics& statistics) const {
+        return std::log(1.0 + (statistics.document_count - statistics.document_freq + 0.5) / (statistics.document_freq + 0.5));
+    }
+
+    double Score(double term_weight, uint32_t term_count, uint32_t word_count) const {
+        return term_weight * (term_count * saturation_) / (term_count + length_base_ + length_factor_ * word_count);
+    }
+
+    // The largest count in the shortest document, the two may come from different postings
+    double GetUpperBound(double term_weight, const PostingBound& bound) const {
+        return bound.max_term_count > 0 ? Score(term_weight, bound.max_term_count, bound.min_word_count) : 0.0;
+    }
+
+private:
+    double saturation_;
+    double length_base_;
+    double length_factor_;
+};
+
+// Calls function(scorer) with the scorer of the ranking function
+template <typename Function>
+decltype(auto) VisitScorer(const RankingOptions& options, double average_word_count, Function function) {
+    if (options.function == RankingFunction::BM25) {
+        return function(Bm25Scorer(options, average_word_count));
+    }
+    return function(TfIdfScorer(options, average_word_count));
+}
@@ -2,7 +2,11 @@
 
 #include <cmath>
 #include <execution>
+#include <exception>
 #include <iterator>
+#include <mutex>
+#include <numeric>
+#include <unordered_set>
 
 using namespace std;
 
@@ -19,39 +23,257 @@ SearchServer::SearchServer(const string& stop_words_text)
 
 void SearchServer::AddDocument(int document_id, string_view document, DocumentStatus status,
                                const vector<int>& ratings) {
-    if ((document_id < 0) || (documents_.count(document_id) > 0)) {
+    CheckNewDocumentId(document_id);
+    const auto tokenized_document = TokenizeDocument(document_id, document, status, ratings);
+
+    const DocumentOrdinal ordinal = AddDocumentData(tokenized_document);
+    for (const auto& [word, term_count] : tokenized_document.word_counts) {
+        const TermId term_id = InternTerm(word);
+        AppendPosting(term_id, ordinal, term_count);
+        UpdateTermStatistics(term_id);
+    }
+    AddDocumentContent(tokenized_document);
+}
+
+void SearchServer::AddDocuments(const vector<NewDocument>& documents) {
+    AddDocuments(execution::seq, documents);
+}
+
+void SearchServer::AddDocuments(const execution::sequenced_policy& policy, const vector<NewDocument>& documents) {
+    CheckNewDocumentIds(documents);
+    vector<TokenizedDocument> tokenized_documents;
+    tokenized_documents.reserve(documents.size());
+    for (const NewDocument& document : documents) {
+        tokenized_documents.push_back(TokenizeDocument(document.id, document.text, document.status, document.ratings));
+    }
+    AddTokenizedDocuments(policy, tokenized_documents);
+}
+
+void SearchServer::AddDocuments(const execution::parallel_policy& policy, const vector<NewDocument>& documents) {
+    CheckNewDocumentIds(documents);
+
+    // Errors are collected, so the one of the first invalid document is rethrown whichever thread finds it
+    vector<TokenizedDocument> tokenized_documents(documents.size());
+    vector<exception_ptr> errors(documents.size());
+    ForEachChunk(policy, documents.size(), 64, [this, &documents, &tokenized_documents, &errors](size_t begin, size_t end) {
+        for (size_t index = begin; index < end; ++index) {
+            const NewDocument& document = documents[index];
+            try {
+                tokenized_documents[index] = TokenizeDocument(document.id, document.text, document.status, document.ratings);
+            } catch (...) {
+                errors[index] = current_exception();
+            }
+        }
+    });
+    for (const exception_ptr& error : errors) {
+        if (error) {
+            rethrow_exception(error);
+        }
+    }
+    AddTokenizedDocuments(policy, tokenized_documents);
+}
+
+SearchServer::TokenizedBatch SearchServer::TokenizeDocuments(const vector<NewDocument>& documents) const {
+    TokenizedBatch batch;
+    batch.documents_.reserve(documents.size());
+    for (const NewDocument& document : documents) {
+        batch.documents_.push_back(TokenizeDocument(document.id, document.text, document.status, document.ratings));
+    }
+    return batch;
+}
+
+void SearchServer::AddDocuments(const execution::parallel_policy& policy, TokenizedBatch& batch) {
+    CheckNewDocumentIds(batch.documents_);
+    AddTokenizedDocuments(policy, batch.documents_);
+    batch.documents_.clear();
+}
+
+template <typename Documents>
+void SearchServer::CheckNewDocumentIds(const Documents& documents) const {
+    unordered_set<int> batch_ids;
+    for (const auto& document : documents) {
+        CheckNewDocumentId(document.id);
+        if (!batch_ids.insert(document.id).second) {
+            throw invalid_argument("Invalid document_id"s);
+        }
+    }
+}
+
+// Every chunk of the batch is turned into a partial inverted index by its own thread. The partial indexes
+// are merged in one pass: each chunk interns its distinct words once, then every touched term appends its
+// fragments in chunk order, which keeps posting lists sorted. Different terms are merged concurrently
+template <typename ExecutionPolicy>
+void SearchServer::AddTokenizedDocuments(const ExecutionPolicy& policy, vector<TokenizedDocument>& documents) {
+    if (documents.empty()) {
+        return;
+    }
+    const DocumentOrdinal first_ordinal = documents_.size();
+    for (const TokenizedDocument& document : documents) {
+        AddDocumentData(document);
+    }
+
+    using Fragment = vector<pair<DocumentOrdinal, uint32_t>>;
+    // A sequential batch is a single chunk, it has nothing to merge
+    const size_t max_chunk_count = IS_SEQUENCED_POLICY<ExecutionPolicy> ? 1 : GetThreadPool().GetThreadCount() * 4;
+    const size_t chunk_count = clamp<size_t>(documents.size() / MIN_PARALLEL_BATCH_SIZE, 1, max_chunk_count);
+    vector<unordered_map<string_view, Fragment>> partial_indexes(chunk_count);
+    ForEachChunk(policy, chunk_count, 1, [&documents, &partial_indexes, chunk_count, first_ordinal](size_t chunk, size_t) {
+        const size_t begin = documents.size() * chunk / chunk_count;
+        const size_t end = documents.size() * (chunk + 1) / chunk_count;
+        auto& partial_index = partial_indexes[chunk];
+        for (size_t i = begin; i < end; ++i) {
+            for (const auto& [word, term_count] : documents[i].word_counts) {
+                partial_index[word].push_back({static_cast<DocumentOrdinal>(first_ordinal + i), term_count});
+            }
+        }
+    });
+
+    unordered_map<TermId, vector<const Fragment*>> term_fragments;
+    for (const auto& partial_index : partial_indexes) {
+        for (const auto& [word, fragment] : partial_index) {
+            term_fragments[InternTerm(word)].push_back(&fragment);
+        }
+    }
+    const vector<pair<TermId, vector<const Fragment*>>> merge_tasks(term_fragments.begin(), term_fragments.end());
+    ForEachChunk(policy, merge_tasks.size(), 64, [this, &merge_tasks](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            for (const Fragment* fragment : merge_tasks[i].second) {
+                for (const auto& [ordinal, term_count] : *fragment) {
+                    AppendPosting(merge_tasks[i].first, ordinal, term_count);
+                }
+            }
+            UpdateTermStatistics(merge_tasks[i].first);
+        }
+    });
+
+    for (const TokenizedDocument& document : documents) {
+        AddDocumentContent(document);
+    }
+}
+
+void SearchServer::CheckNewDocumentId(int document_id) const {
+    if ((document_id < 0) || (document_ordinals_.count(document_id) > 0)) {
         throw invalid_argument("Invalid document_id"s);
     }
-    const auto [it, inserted] = documents_.emplace(document_id, DocumentData{ComputeAverageRating(ratings), status, string(document)});
-    const auto words = SplitIntoWordsNoStop(it->second.text);
+}
 
-    const double inv_word_count = 1.0 / words.size();
+SearchServer::TokenizedDocument SearchServer::TokenizeDocument(int document_id, string_view document, DocumentStatus status,
+                                                               const vector<int>& ratings) const {
+    auto words = SplitIntoWordsNoStop(document);
+    TokenizedDocument result{document_id, document, status, ComputeAverageRating(ratings), {}, static_cast<uint32_t>(words.size())};
+    sort(words.begin(), words.end());
     for (const string_view word : words) {
-        word_to_document_freqs_[word][document_id] += inv_word_count;
-        document_to_word_freqs_[document_id][word] += inv_word_count;
+        if (result.word_counts.empty() || result.word_counts.back().first != word) {
+            result.word_counts.push_back({word, 0});
+        }
+        ++result.word_counts.back().second;
+    }
+    return result;
+}
+
+DocumentOrdinal SearchServer::AddDocumentData(const TokenizedDocument& document) {
+    const DocumentOrdinal ordinal = documents_.size();
+    documents_.push_back({document.id, document.rating, document.status});
+    document_word_counts_.push_back(document.word_count);
+    word_count_ += document.word_count;
+    document_ordinals_.emplace(document.id, ordinal);
+    if (document_ids_.empty() || GetEntryId(document_ids_.back()) < document.id) {
+        document_ids_.push_back(document.id);
+    } else if (const auto it = FindIdEntry(document.id); it != document_ids_.end() && *it == ~document.id) {
+        // The id was removed since the last compaction, its entry is revived
+        *it = document.id;
+    } else {
+        document_ids_.insert(it, document.id);
+    }
+    if (static_cast<size_t>(document.status) < STATUS_COUNT) {
+        status_documents_[static_cast<size_t>(document.status)].Set(ordinal);
     }
-    document_ids_.insert(document_id);
+    version_ = GetNextVersion();
+    return ordinal;
+}
+
+// Terms of the document must already be interned
+void SearchServer::AddDocumentContent(const TokenizedDocument& document) {
+    vector<TermCount> terms;
+    terms.reserve(document.word_counts.size());
+    WordSetFingerprint fingerprint;
+    for (const auto& [word, term_count] : document.word_counts) {
+        terms.push_back({*terms_.Find(word), term_count});
+        fingerprint ^= ComputeWordFingerprint(word);
+    }
+    document_fingerprints_.push_back(fingerprint);
+    sort(terms.begin(), terms.end(), [](const TermCount& lhs, const TermCount& rhs) {
+        return lhs.term_id < rhs.term_id;
+    });
+    document_contents_.push_back({document_texts_.Add(document.text.data(), document.text.size()),
+                                  document_terms_.Add(terms.data(), terms.size())});
 }
 
 int SearchServer::GetDocumentCount() const {
-    return documents_.size();
+    return document_ordinals_.size();
+}
+
+bool SearchServer::HasDocument(int document_id) const {
+    return document_ordinals_.count(document_id) > 0;
 }
 
-set<int>::const_iterator SearchServer::begin() const {
-    return document_ids_.begin();
+uint64_t SearchServer::GetVersion() const {
+    return version_;
 }
 
-set<int>::const_iterator SearchServer::end() const {
-    return document_ids_.end();
+uint64_t SearchServer::GetNextVersion() {
+    static atomic<uint64_t> next_version{0};
+    return ++next_version;
+}
+
+string SearchServer::GetQueryKey(string_view raw_query) const {
+    const Query query = ParseQuery(raw_query);
+    string key;
+    for (const string_view word : query.plus_words) {
+        if (!key.empty()) {
+            key += ' ';
+        }
+        key += word;
+    }
+    for (const string_view word : query.minus_words) {
+        key += " -"s;
+        key += word;
+    }
+    return key;
 }
 
-const map<string_view, double>& SearchServer::GetWordFrequencies(int document_id) const {
-    static const map<string_view, double> dummy;
-    if (document_to_word_freqs_.count(document_id) == 0) {
-        return dummy;
+void SearchServer::CollectStatistics(string_view raw_query, CollectionStatistics& statistics) const {
+    statistics.document_count += GetDocumentCount();
+    statistics.word_count += word_count_;
+    for (const string_view word : ParseQuery(raw_query).plus_words) {
+        auto it = statistics.document_freqs.find(word);
+        if (it == statistics.document_freqs.end()) {
+            it = statistics.document_freqs.emplace(string(word), 0).first;
+        }
+        if (const auto term_id = FindTerm(word)) {
+            it->second += GetDocumentFreq(*term_id);
+        }
     }
+}
+
+SearchServer::DocumentIdIterator SearchServer::begin() const {
+    return {document_ids_.data(), document_ids_.data() + document_ids_.size()};
+}
 
-    return document_to_word_freqs_.at(document_id);
+SearchServer::DocumentIdIterator SearchServer::end() const {
+    return {document_ids_.data() + document_ids_.size(), document_ids_.data() + document_ids_.size()};
+}
+
+SearchServer::WordFrequencies SearchServer::GetWordFrequencies(int document_id) const {
+    WordFrequencies word_freqs;
+    const auto it = document_ordinals_.find(document_id);
+    if (it == document_ordinals_.end()) {
+        return word_freqs;
+    }
+    word_freqs.terms_ = GetDocumentTerms(it->second);
+    word_freqs.dictionary_ = &terms_;
+    word_freqs.inv_word_count_ = 1.0 / document_word_counts_[it->second];
+    return word_freqs;
 }
 
 SearchServer::MatchDocumentResult SearchServer::MatchDocument(string_view raw_query, int document_id) const {
@@ -59,58 +281,120 @@ SearchServer::MatchDocumentResult SearchServer::MatchDocument(string_view raw_qu
 }
 
 SearchServer::MatchDocumentResult SearchServer::MatchDocument(const execution::sequenced_policy&, string_view raw_query, int document_id) const {
-    const auto query = ParseQuery(raw_query);
+    // Only the returned words are allocated once the buffers of the thread have grown
+    thread_local QueryContext context;
+    return MatchDocument(context, raw_query, document_id);
+}
 
-    const auto status = documents_.at(document_id).status;
+const SearchServer::MatchDocumentResult& SearchServer::MatchDocument(QueryContext& context, string_view raw_query, int document_id) const {
+    ParseQuery(raw_query, context.query_);
+    const DocumentOrdinal ordinal = GetDocumentOrdinal(document_id);
+    PrepareMatchQuery(context.query_, context.match_query_);
 
-    for (const string_view word : query.minus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
-        }
-        if (word_to_document_freqs_.at(word).count(document_id)) {
-            return {{}, status};
-        }
-    }
+    auto& [matched_words, status] = context.match_result_;
+    status = documents_[ordinal].status;
+    MatchTerms(context.match_query_, ordinal, matched_words);
+    return context.match_result_;
+}
 
-    vector<string_view> matched_words;
-    for (const string_view word : query.plus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
-        }
-        if (word_to_document_freqs_.at(word).count(document_id)) {
-            matched_words.push_back(word);
-        }
+// Matching one document is a single pass over its forward index, too short to be worth splitting
+SearchServer::MatchDocumentResult SearchServer::MatchDocument(const execution::parallel_policy&, string_view raw_query, int document_id) const {
+    return MatchDocument(execution::seq, raw_query, document_id);
+}
+
+vector<SearchServer::MatchDocumentResult> SearchServer::MatchDocuments(string_view raw_query, const vector<int>& document_ids) const {
+    MatchQuery query;
+    PrepareMatchQuery(ParseQuery(raw_query), query);
+    vector<MatchDocumentResult> results(document_ids.size());
+    for (size_t i = 0; i < document_ids.size(); ++i) {
+        const DocumentOrdinal ordinal = GetDocumentOrdinal(document_ids[i]);
+        auto& [matched_words, status] = results[i];
+        status = documents_[ordinal].status;
+        MatchTerms(query, ordinal, matched_words);
     }
-    return {matched_words, status};
+    return results;
 }
 
-SearchServer::MatchDocumentResult SearchServer::MatchDocument(const execution::parallel_policy&, string_view raw_query, int document_id) const {
-    const auto query = ParseQuery(raw_query, /* skip_sort */ true);
+vector<SearchServer::MatchDocumentResult> SearchServer::MatchDocuments(const execution::parallel_policy&, string_view raw_query,
+                                                                       const vector<int>& document_ids) const {
+    MatchQuery query;
+    PrepareMatchQuery(ParseQuery(raw_query), query);
+    // Unknown ids are reported before any work is split
+    vector<DocumentOrdinal> ordinals(document_ids.size());
+    for (size_t i = 0; i < document_ids.size(); ++i) {
+        ordinals[i] = GetDocumentOrdinal(document_ids[i]);
+    }
+    vector<MatchDocumentResult> results(document_ids.size());
+    GetThreadPool().ParallelFor(ordinals.size(), 256, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            auto& [matched_words, status] = results[i];
+            status = documents_[ordinals[i]].status;
+            MatchTerms(query, ordinals[i], matched_words);
+        }
+    });
+    return results;
+}
 
-    const auto status = documents_.at(document_id).status;
+void SearchServer::PrepareMatchQuery(const Query& query, MatchQuery& result) const {
+    const auto find_terms = [this](const vector<string_view>& words, vector<TermId>& terms) {
+        terms.clear();
+        for (const string_view word : words) {
+            if (const auto term_id = FindTerm(word)) {
+                terms.push_back(*term_id);
+            }
+        }
+        sort(terms.begin(), terms.end());
+        terms.erase(unique(terms.begin(), terms.end()), terms.end());
+    };
+    find_terms(query.plus_words, result.plus_terms);
+    find_terms(query.minus_words, result.minus_terms);
+}
 
-    const auto word_checker = 
-        [this, document_id](string_view word) {
-            const auto it = word_to_document_freqs_.find(word);
-            return it != word_to_document_freqs_.end() && it->second.count(document_id);
-        };
+namespace {
 
-    if (any_of(execution::par, query.minus_words.begin(), query.minus_words.end(), word_checker)) {
-        return {{}, status};
+// First element of [first, last) with a term id not below term_id. The step doubles from first, so a query
+// term costs the logarithm of its distance from the previous one rather than of the whole document
+template <typename Iterator>
+Iterator GallopToTerm(Iterator first, Iterator last, TermId term_id) {
+    if (first == last || first->term_id >= term_id) {
+        return first;
     }
+    // first->term_id < term_id holds for the left end of every probed step
+    size_t step = 1;
+    while (static_cast<size_t>(last - first) > step && first[step].term_id < term_id) {
+        first += step;
+        step *= 2;
+    }
+    const Iterator bound = first + min<size_t>(step, last - first);
+    return lower_bound(first + 1, bound, term_id, [](const auto& term, TermId id) {
+        return term.term_id < id;
+    });
+}
+
+}  // namespace
 
-    vector<string_view> matched_words(query.plus_words.size());
-    auto words_end = copy_if(
-        execution::par,
-        query.plus_words.begin(), query.plus_words.end(),
-        matched_words.begin(),
-        word_checker
-    );
-    sort(matched_words.begin(), words_end);
-    words_end = unique(matched_words.begin(), words_end);
-    matched_words.erase(words_end, matched_words.end());
+void SearchServer::MatchTerms(const MatchQuery& query, DocumentOrdinal ordinal, vector<string_view>& matched_words) const {
+    matched_words.clear();
+    const TermCountRange terms = GetDocumentTerms(ordinal);
+    const auto contains = [&terms](const TermCount*& position, TermId term_id) {
+        position = GallopToTerm(position, terms.end(), term_id);
+        return position != terms.end() && position->term_id == term_id;
+    };
 
-    return {matched_words, status};
+    const TermCount* position = terms.begin();
+    for (const TermId term_id : query.minus_terms) {
+        if (contains(position, term_id)) {
+            return;
+        }
+    }
+    position = terms.begin();
+    for (const TermId term_id : query.plus_terms) {
+        if (contains(position, term_id)) {
+            // Point into the term dictionary rather than into the caller's query
+            matched_words.push_back(terms_[term_id]);
+        }
+    }
+    sort(matched_words.begin(), matched_words.end());
 }
 
 bool SearchServer::IsStopWord(string_view word) const {
@@ -126,14 +410,14 @@ bool SearchServer::IsValidWord(string_view word) {
 
 vector<string_view> SearchServer::SplitIntoWordsNoStop(string_view text) const {
     vector<string_view> words;
-    for (const string_view word : SplitIntoWords(text)) {
-        if (!IsValidWord(word)) {
+    ForEachWord(text, [this, &words](string_view word, bool is_valid) {
+        if (!is_valid) {
             throw std::invalid_argument("Word "s + string(word) + " is invalid"s);
         }
         if (!IsStopWord(word)) {
             words.push_back(word);
         }
-    }
+    });
     return words;
 }
 
@@ -148,7 +432,7 @@ int SearchServer::ComputeAverageRating(const vector<int>& ratings) {
     return rating_sum / static_cast<int>(ratings.size());
 }
 
-SearchServer::QueryWord SearchServer::ParseQueryWord(string_view word) const {
+SearchServer::QueryWord SearchServer::ParseQueryWord(string_view word, bool is_valid) const {
     if (word.empty()) {
         throw std::invalid_argument("Query word is empty"s);
     }
@@ -157,7 +441,7 @@ SearchServer::QueryWord SearchServer::ParseQueryWord(string_view word) const {
         is_minus = true;
         word.remove_prefix(1);
     }
-    if (word.empty() || word[0] == '-' || !IsValidWord(word)) {
+    if (word.empty() || word[0] == '-' || !is_valid) {
         throw std::invalid_argument("Query word "s + string(word) + " is invalid");
     }
 
@@ -166,8 +450,15 @@ SearchServer::QueryWord SearchServer::ParseQueryWord(string_view word) const {
 
 SearchServer::Query SearchServer::ParseQuery(string_view text, bool skip_sort) const {
     Query result;
-    for (const string_view word : SplitIntoWords(text)) {
-        const auto query_word = ParseQueryWord(word);
+    ParseQuery(text, result, skip_sort);
+    return result;
+}
+
+void SearchServer::ParseQuery(string_view text, Query& result, bool skip_sort) const {
+    result.plus_words.clear();
+    result.minus_words.clear();
+    ForEachWord(text, [this, &result](string_view word, bool is_valid) {
+        const auto query_word = ParseQueryWord(word, is_valid);
         if (!query_word.is_stop) {
             if (query_word.is_minus) {
                 result.minus_words.push_back(query_word.data);
@@ -175,19 +466,195 @@ SearchServer::Query SearchServer::ParseQuery(string_view text, bool skip_sort) c
                 result.plus_words.push_back(query_word.data);
             }
         }
-    }
+    });
     if (!skip_sort) {
         for (auto* words : {&result.plus_words, &result.minus_words}) {
             sort(words->begin(), words->end());
             words->erase(unique(words->begin(), words->end()), words->end());
         }
     }
-    return result;
 }
 
-// Existence required
-double SearchServer::ComputeWordInverseDocumentFreq(string_view word) const {
-    return log(GetDocumentCount() * 1.0 / word_to_document_freqs_.at(word).size());
+TermId SearchServer::InternTerm(string_view word) {
+    const auto [term_id, is_new] = terms_.Intern(word);
+    if (is_new) {
+        if (posting_format_ == PostingFormat::COMPRESSED) {
+            compressed_postings_.emplace_back();
+        } else {
+            postings_.emplace_back();
+        }
+        term_log_document_freqs_.push_back(0.0);
+    }
+    return term_id;
+}
+
+optional<TermId> SearchServer::FindTerm(string_view word) const {
+    const auto term_id = terms_.Find(word);
+    if (!term_id || GetDocumentFreq(*term_id) == 0) {
+        return nullopt;
+    }
+    return term_id;
+}
+
+size_t SearchServer::GetDocumentFreq(TermId term_id) const {
+    return posting_format_ == PostingFormat::COMPRESSED ? compressed_postings_[term_id].size() : postings_[term_id].size();
+}
+
+const PostingBound& SearchServer::GetPostingBound(TermId term_id) const {
+    return posting_format_ == PostingFormat::COMPRESSED ? compressed_postings_[term_id].GetBound() : postings_[term_id].GetBound();
+}
+
+void SearchServer::AppendPosting(TermId term_id, DocumentOrdinal ordinal, uint32_t term_count) {
+    if (posting_format_ == PostingFormat::COMPRESSED) {
+        compressed_postings_[term_id].Append(ordinal, term_count, document_word_counts_[ordinal]);
+    } else {
+        postings_[term_id].Append(ordinal, term_count, document_word_counts_[ordinal]);
+    }
+}
+
+void SearchServer::ErasePosting(TermId term_id, DocumentOrdinal ordinal, uint32_t term_count) {
+    // The bound is only rebuilt if the erased posting may have reached it
+    const auto erase = [this, ordinal, term_count](auto& postings) {
+        if (postings.Erase(ordinal) && postings.GetBound().IsReachedBy(term_count, document_word_counts_[ordinal])) {
+            postings.UpdateBound(document_word_counts_.data());
+        }
+    };
+    if (posting_format_ == PostingFormat::COMPRESSED) {
+        erase(compressed_postings_[term_id]);
+    } else {
+        erase(postings_[term_id]);
+    }
+    UpdateTermStatistics(term_id);
+}
+
+void SearchServer::ErasePostings(TermId term_id, const DocumentOrdinal* first, const DocumentOrdinal* last) {
+    if (posting_format_ == PostingFormat::COMPRESSED) {
+        compressed_postings_[term_id].Erase(first, last, document_word_counts_.data());
+    } else {
+        postings_[term_id].Erase(first, last, document_word_counts_.data());
+    }
+    UpdateTermStatistics(term_id);
+}
+
+void SearchServer::UpdateTermStatistics(TermId term_id) {
+    const size_t document_freq = GetDocumentFreq(term_id);
+    term_log_document_freqs_[term_id] = document_freq > 0 ? log(static_cast<double>(document_freq)) : 0.0;
+}
+
+namespace {
+
+uint64_t MixBits(uint64_t value) {
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111eb;
+    return value ^ (value >> 31);
+}
+
+}  // namespace
+
+// Two independent FNV-1a style passes with different multipliers, finished with the splitmix64 mixer
+SearchServer::WordSetFingerprint SearchServer::ComputeWordFingerprint(string_view word) {
+    uint64_t low = 0xcbf29ce484222325;
+    uint64_t high = 0x6a09e667f3bcc908;
+    for (const unsigned char c : word) {
+        low = (low ^ c) * 0x100000001b3;
+        high = (high ^ c) * 0x9e3779b97f4a7c15;
+    }
+    return {MixBits(low ^ word.size()), MixBits(high + word.size())};
+}
+
+bool SearchServer::HasSameWords(DocumentOrdinal lhs, DocumentOrdinal rhs) const {
+    const TermCountRange lhs_terms = GetDocumentTerms(lhs);
+    const TermCountRange rhs_terms = GetDocumentTerms(rhs);
+    return equal(lhs_terms.begin(), lhs_terms.end(), rhs_terms.begin(), rhs_terms.end(),
+                 [](const TermCount& lhs_term, const TermCount& rhs_term) {
+                     return lhs_term.term_id == rhs_term.term_id;
+                 });
+}
+
+DocumentOrdinal SearchServer::GetDocumentOrdinal(int document_id) const {
+    return document_ordinals_.at(document_id);
+}
+
+SearchServer::NewDocument SearchServer::GetDocument(int document_id) const {
+    const DocumentOrdinal ordinal = GetDocumentOrdinal(document_id);
+    const DocumentData& document_data = documents_[ordinal];
+    return {document_id, GetDocumentText(ordinal), document_data.status, {document_data.rating}};
+}
+
+void SearchServer::PrepareQuery(const Query& query, PreparedQuery& result, const CollectionStatistics* statistics) const {
+    result.plus_terms.clear();
+    result.minus_terms.clear();
+    const int document_count = statistics == nullptr ? GetDocumentCount() : statistics->document_count;
+    const uint64_t word_count = statistics == nullptr ? word_count_ : statistics->word_count;
+    result.ranking = ranking_;
+    result.average_word_count = document_count > 0 ? static_cast<double>(word_count) / document_count : 0.0;
+    TermStatistics term_statistics;
+    term_statistics.document_count = document_count;
+    term_statistics.log_document_count = log(static_cast<double>(document_count));
+    VisitScorer(result.ranking, result.average_word_count, [&](const auto& scorer) {
+        for (const string_view word : query.plus_words) {
+            const auto term_id = FindTerm(word);
+            if (!term_id) {
+                continue;
+            }
+            // Local terms keep the log of their document frequency, so no log is taken per term
+            if (statistics == nullptr) {
+                term_statistics.document_freq = GetDocumentFreq(*term_id);
+                term_statistics.log_document_freq = term_log_document_freqs_[*term_id];
+            } else {
+                const auto it = statistics->document_freqs.find(word);
+                if (it == statistics->document_freqs.end() || it->second <= 0) {
+                    continue;
+                }
+                term_statistics.document_freq = it->second;
+                term_statistics.log_document_freq = log(static_cast<double>(it->second));
+            }
+            const double weight = scorer.GetTermWeight(term_statistics);
+            result.plus_terms.push_back({*term_id, weight, scorer.GetUpperBound(weight, GetPostingBound(*term_id))});
+        }
+    });
+    sort(result.plus_terms.begin(), result.plus_terms.end(), [](const ScoredTerm& lhs, const ScoredTerm& rhs) {
+        return lhs.upper_bound < rhs.upper_bound;
+    });
+    result.bound_prefix.assign(result.plus_terms.size() + 1, 0.0);
+    for (size_t i = 0; i < result.plus_terms.size(); ++i) {
+        result.bound_prefix[i + 1] = result.bound_prefix[i] + result.plus_terms[i].upper_bound;
+    }
+
+    for (const string_view word : query.minus_words) {
+        if (const auto term_id = FindTerm(word)) {
+            result.minus_terms.push_back(*term_id);
+        }
+    }
+}
+
+void SearchServer::PrepareFilter(PreparedQuery& query, const DocumentBitmap* allowed_documents,
+                                 const DocumentBitmap* removed_documents) const {
+    query.allowed_documents = allowed_documents;
+    query.removed_documents = removed_documents;
+    query.has_excluded_documents = !query.minus_terms.empty();
+    if (!query.has_excluded_documents) {
+        return;
+    }
+    // Only the words up to the last excluded ordinal are cleared, the capacity is kept
+    DocumentBitmap& excluded_documents = query.excluded_documents;
+    excluded_documents.Assign(0, false);
+    for (const TermId term_id : query.minus_terms) {
+        if (posting_format_ == PostingFormat::COMPRESSED) {
+            compressed_postings_[term_id].ForEach([&excluded_documents](DocumentOrdinal ordinal, uint32_t) {
+                excluded_documents.Set(ordinal);
+            });
+        } else {
+            for (const DocumentOrdinal ordinal : postings_[term_id].GetOrdinals()) {
+                excluded_documents.Set(ordinal);
+            }
+        }
+    }
+}
+
+const DocumentBitmap* SearchServer::GetStatusDocuments(DocumentStatus status) const {
+    const auto index = static_cast<size_t>(status);
+    return index < STATUS_COUNT ? &status_documents_[index] : nullptr;
 }
 
 void SearchServer::RemoveDocument(int document_id) {
@@ -195,50 +662,326 @@ void SearchServer::RemoveDocument(int document_id) {
 }
 
 void SearchServer::RemoveDocument(const execution::sequenced_policy&, int document_id) {
-    if (document_to_word_freqs_.count(document_id) == 0) {
+    const auto it = document_ordinals_.find(document_id);
+    if (it == document_ordinals_.end()) {
         return;
     }
+    const DocumentOrdinal ordinal = it->second;
 
-    document_ids_.erase(document_id);
-    documents_.erase(document_id);
-
-    for (auto& [word, freq] : document_to_word_freqs_.at(document_id)) {
-        word_to_document_freqs_.at(word).erase(document_id);
+    for (const TermCount& term : GetDocumentTerms(ordinal)) {
+        ErasePosting(term.term_id, ordinal, term.count);
     }
 
-    document_to_word_freqs_.erase(document_id);
+    ReleaseDocument(ordinal);
+    CompactOrdinals(execution::seq);
+}
+
+void SearchServer::RemoveDocuments(const vector<int>& document_ids) {
+    RemoveDocuments(execution::seq, document_ids);
+}
+
+vector<vector<int>> SearchServer::FindDuplicates() const {
+    return FindDuplicates(execution::seq);
+}
+
+vector<int> SearchServer::RemoveDuplicates() {
+    return RemoveDuplicates(execution::seq);
 }
 
 void SearchServer::RemoveDocument(const execution::parallel_policy&, int document_id) {
-    if (document_to_word_freqs_.count(document_id) == 0) {
+    const auto it = document_ordinals_.find(document_id);
+    if (it == document_ordinals_.end()) {
         return;
     }
+    const DocumentOrdinal ordinal = it->second;
 
-    document_ids_.erase(document_id);
-    documents_.erase(document_id);
-
-    const auto& word_freqs = document_to_word_freqs_.at(document_id);
-    vector<string_view> words(word_freqs.size());
-    transform(
-        execution::par,
-        word_freqs.begin(), word_freqs.end(),
-        words.begin(),
-        [](const auto& item) { return item.first; }
-    );
-    for_each(
-        execution::par,
-        words.begin(), words.end(),
-        [this, document_id](string_view word) {
-            word_to_document_freqs_.at(word).erase(document_id);
-        });
+    const TermCountRange terms = GetDocumentTerms(ordinal);
+    // Every word owns a separate posting list, so they can be updated concurrently
+    GetThreadPool().ParallelFor(terms.size(), 16, [this, &terms, ordinal](size_t begin, size_t end) {
+        for (const TermCount* term = terms.begin() + begin; term != terms.begin() + end; ++term) {
+            ErasePosting(term->term_id, ordinal, term->count);
+        }
+    });
+
+    ReleaseDocument(ordinal);
+    CompactOrdinals(execution::par);
+}
 
-    document_to_word_freqs_.erase(document_id);
+string_view SearchServer::GetDocumentText(DocumentOrdinal ordinal) const {
+    const Arena<char>::Ref text = document_contents_[ordinal].text;
+    return {document_texts_.GetData(text), text.size};
 }
 
-std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, DocumentStatus status) const {
-    return FindTopDocuments(std::execution::seq, raw_query, status);
+SearchServer::TermCountRange SearchServer::GetDocumentTerms(DocumentOrdinal ordinal) const {
+    const Arena<TermCount>::Ref terms = document_contents_[ordinal].terms;
+    const TermCount* first = document_terms_.GetData(terms);
+    return {first, first + terms.size};
+}
+
+void SearchServer::ReleaseDocument(DocumentOrdinal ordinal) {
+    DocumentData& document_data = documents_[ordinal];
+    if (const auto it = FindIdEntry(document_data.id); it != document_ids_.end() && *it == document_data.id) {
+        *it = ~document_data.id;
+    }
+    document_ordinals_.erase(document_data.id);
+    word_count_ -= document_word_counts_[ordinal];
+    document_data.id = -1;
+    if (static_cast<size_t>(document_data.status) < STATUS_COUNT) {
+        status_documents_[static_cast<size_t>(document_data.status)].Reset(ordinal);
+    }
+    version_ = GetNextVersion();
+    document_contents_[ordinal] = {};
+    if (++released_document_count_ >= max(MIN_RELEASED_DOCUMENTS_TO_COMPACT, document_ordinals_.size())) {
+        CompactDocumentContents();
+    }
+}
+
+vector<int>::iterator SearchServer::FindIdEntry(int document_id) {
+    return lower_bound(document_ids_.begin(), document_ids_.end(), document_id, [](int entry, int id) {
+        return GetEntryId(entry) < id;
+    });
+}
+
+void SearchServer::CompactDocumentContents() {
+    vector<Arena<char>::Ref*> texts;
+    vector<Arena<TermCount>::Ref*> terms;
+    texts.reserve(document_ordinals_.size());
+    terms.reserve(document_ordinals_.size());
+    for (DocumentContent& content : document_contents_) {
+        texts.push_back(&content.text);
+        terms.push_back(&content.terms);
+    }
+    document_texts_.Compact(texts);
+    document_terms_.Compact(terms);
+    released_document_count_ = 0;
+}
+
+void SearchServer::RemapPostings(TermId term_id, const vector<DocumentOrdinal>& new_ordinals) {
+    if (posting_format_ != PostingFormat::COMPRESSED) {
+        postings_[term_id].Remap(new_ordinals.data());
+        return;
+    }
+    CompressedPostingList& postings = compressed_postings_[term_id];
+    if (postings.empty()) {
+        return;
+    }
+    // Block boundaries move with the ordinals, so the list is encoded again
+    CompressedPostingList remapped;
+    postings.ForEach([this, &new_ordinals, &remapped](DocumentOrdinal ordinal, uint32_t term_count) {
+        remapped.Append(new_ordinals[ordinal], term_count, document_word_counts_[ordinal]);
+    });
+    postings = move(remapped);
+}
+
+void SearchServer::CompactDocuments(const vector<DocumentOrdinal>& new_ordinals) {
+    size_t live_count = 0;
+    for (size_t ordinal = 0; ordinal < documents_.size(); ++ordinal) {
+        if (documents_[ordinal].id == -1) {
+            continue;
+        }
+        documents_[live_count] = documents_[ordinal];
+        document_word_counts_[live_count] = document_word_counts_[ordinal];
+        document_contents_[live_count] = document_contents_[ordinal];
+        document_fingerprints_[live_count] = document_fingerprints_[ordinal];
+        ++live_count;
+    }
+    documents_.resize(live_count);
+    document_word_counts_.resize(live_count);
+    document_contents_.resize(live_count);
+    document_fingerprints_.resize(live_count);
+    for (auto& [document_id, ordinal] : document_ordinals_) {
+        ordinal = new_ordinals[ordinal];
+    }
+    // Removed ids are at most as many as the released slots, so they are dropped here as well
+    document_ids_.erase(remove_if(document_ids_.begin(), document_ids_.end(), [](int entry) {
+        return entry < 0;
+    }), document_ids_.end());
+    for (DocumentBitmap& status_documents : status_documents_) {
+        status_documents.Assign(live_count, false);
+    }
+    for (size_t ordinal = 0; ordinal < live_count; ++ordinal) {
+        if (static_cast<size_t>(documents_[ordinal].status) < STATUS_COUNT) {
+            status_documents_[static_cast<size_t>(documents_[ordinal].status)].Set(ordinal);
+        }
+    }
+}
+
+CompressedPostingList SearchServer::CompressPostings(const PostingList& postings) const {
+    CompressedPostingList result;
+    const auto& ordinals = postings.GetOrdinals();
+    const auto& term_counts = postings.GetTermCounts();
+    for (size_t i = 0; i < ordinals.size(); ++i) {
+        result.Append(ordinals[i], term_counts[i], document_word_counts_[ordinals[i]]);
+    }
+    return result;
+}
+
+void SearchServer::SetMetrics(SearchMetrics* metrics) {
+    metrics_ = metrics;
+}
+
+SearchMetrics* SearchServer::GetMetrics() const {
+    return metrics_;
+}
+
+void SearchServer::SetThreadPool(ThreadPool* thread_pool) {
+    thread_pool_ = thread_pool;
+}
+
+ThreadPool& SearchServer::GetThreadPool() const {
+    return thread_pool_ != nullptr ? *thread_pool_ : ThreadPool::GetDefault();
+}
+
+void SearchServer::SetPostingFormat(PostingFormat format) {
+    if (format == posting_format_) {
+        return;
+    }
+    if (format == PostingFormat::COMPRESSED) {
+        compressed_postings_.reserve(postings_.size());
+        for (const PostingList& postings : postings_) {
+            compressed_postings_.push_back(CompressPostings(postings));
+        }
+        vector<PostingList>().swap(postings_);
+    } else {
+        postings_.resize(compressed_postings_.size());
+        for (size_t term_id = 0; term_id < compressed_postings_.size(); ++term_id) {
+            compressed_postings_[term_id].ForEach([this, term_id](DocumentOrdinal ordinal, uint32_t term_count) {
+                postings_[term_id].Append(ordinal, term_count, document_word_counts_[ordinal]);
+            });
+        }
+        vector<CompressedPostingList>().swap(compressed_postings_);
+    }
+    posting_format_ = format;
+}
+
+PostingFormat SearchServer::GetPostingFormat() const {
+    return posting_format_;
+}
+
+void SearchServer::SetRanking(const RankingOptions& options) {
+    if (!(options.k1 >= 0.0) || !(options.b >= 0.0 && options.b <= 1.0)) {
+        throw invalid_argument("Invalid ranking parameters"s);
+    }
+    ranking_ = options;
+    // Cached results were scored with the previous ranking
+    version_ = GetNextVersion();
+}
+
+const RankingOptions& SearchServer::GetRanking() const {
+    return ranking_;
+}
+
+size_t SearchServer::GetPostingsMemoryUsage() const {
+    size_t result = 0;
+    for (const PostingList& postings : postings_) {
+        result += postings.GetMemoryUsage();
+    }
+    for (const CompressedPostingList& postings : compressed_postings_) {
+        result += postings.GetMemoryUsage();
+    }
+    return result;
+}
+
+std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, DocumentStatus status, size_t max_result_count) const {
+    return FindTopDocuments(std::execution::seq, raw_query, status, max_result_count);
 }
 
 std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query) const {
     return FindTopDocuments(std::execution::seq, raw_query);
+}
+
+vector<Document> SearchServer::FindTopDocumentsPage(string_view raw_query, DocumentStatus status, size_t page_number,
+                                                    size_t page_size) const {
+    return FindTopDocumentsPage(raw_query, StatusFilter{status}, page_number, page_size);
+}
+
+vector<Document> SearchServer::FindTopDocumentsPage(string_view raw_query, size_t page_number, size_t page_size) const {
+    return FindTopDocumentsPage(raw_query, DocumentStatus::ACTUAL, page_number, page_size);
+}
+
+const std::vector<Document>& SearchServer::FindTopDocuments(QueryContext& context, std::string_view raw_query, DocumentStatus status,
+                                                            size_t max_result_count) const {
+    return FindTopDocuments(context, raw_query, StatusFilter{status}, max_result_count);
+}
+
+const std::vector<Document>& SearchServer::FindTopDocuments(QueryContext& context, std::string_view raw_query) const {
+    return FindTopDocuments(context, raw_query, DocumentStatus::ACTUAL);
+}
+
+vector<vector<Document>> SearchServer::FindTopDocumentsBatch(const vector<string>& queries, DocumentStatus status,
+                                                             size_t max_result_count) const {
+    return FindTopDocumentsBatch(GetThreadPool(), queries, status, max_result_count);
+}
+
+vector<vector<Document>> SearchServer::FindTopDocumentsBatch(ThreadPool& thread_pool, const vector<string>& queries,
+                                                             DocumentStatus status, size_t max_result_count) const {
+    vector<vector<Document>> results(queries.size());
+    vector<PreparedQuery> prepared_queries;
+    vector<size_t> order;
+    // Accumulators are sized to the index, so they belong to the call rather than to the threads: a chunk borrows
+    // one, at most one per thread of the loop is made, and all of them are freed once the batch is done
+    vector<unique_ptr<BatchAccumulator>> free_accumulators;
+    mutex accumulator_mutex;
+    for (size_t window_begin = 0; window_begin < queries.size(); window_begin += BATCH_WINDOW_SIZE) {
+        const size_t window_size = min(BATCH_WINDOW_SIZE, queries.size() - window_begin);
+        prepared_queries.resize(window_size);
+        thread_pool.ParallelFor(window_size, 64, [&](size_t begin, size_t end) {
+            Query query;
+            for (size_t i = begin; i < end; ++i) {
+                ParseQuery(queries[window_begin + i], query);
+                PrepareQuery(query, prepared_queries[i]);
+            }
+        });
+
+        // Queries with the same longest posting list read the same memory, so they are given to the same thread
+        const auto get_longest_term = [&](const PreparedQuery& query) {
+            TermId longest_term = numeric_limits<TermId>::max();
+            size_t longest_size = 0;
+            for (const ScoredTerm& term : query.plus_terms) {
+                const size_t size = GetDocumentFreq(term.term_id);
+                if (longest_term == numeric_limits<TermId>::max() || size > longest_size) {
+                    longest_term = term.term_id;
+                    longest_size = size;
+                }
+            }
+            return longest_term;
+        };
+        vector<TermId> longest_terms(window_size);
+        for (size_t i = 0; i < window_size; ++i) {
+            longest_terms[i] = get_longest_term(prepared_queries[i]);
+        }
+        order.resize(window_size);
+        iota(order.begin(), order.end(), 0);
+        stable_sort(order.begin(), order.end(), [&longest_terms](size_t lhs, size_t rhs) {
+            return longest_terms[lhs] < longest_terms[rhs];
+        });
+
+        thread_pool.ParallelFor(window_size, 16, [&](size_t begin, size_t end) {
+            unique_ptr<BatchAccumulator> accumulator;
+            {
+                lock_guard guard(accumulator_mutex);
+                if (!free_accumulators.empty()) {
+                    accumulator = move(free_accumulators.back());
+                    free_accumulators.pop_back();
+                }
+            }
+            if (!accumulator) {
+                accumulator = make_unique<BatchAccumulator>();
+            }
+            for (size_t i = begin; i < end; ++i) {
+                const PreparedQuery& query = prepared_queries[order[i]];
+                vector<Document>& result = results[window_begin + order[i]];
+                VisitScorer(query.ranking, query.average_word_count, [&](const auto& scorer) {
+                    if (posting_format_ == PostingFormat::COMPRESSED) {
+                        EvaluateBatchQuery<CompressedPostingList::Cursor>(query, scorer, status, max_result_count, *accumulator, result);
+                    } else {
+                        EvaluateBatchQuery<PostingList::Cursor>(query, scorer, status, max_result_count, *accumulator, result);
+                    }
+                });
+            }
+            lock_guard guard(accumulator_mutex);
+            free_accumulators.push_back(move(accumulator));
+        });
+    }
+    return results;
 }
\ No newline at end of file
@@ -1,19 +1,56 @@
 #pragma once
 
-#include "concurrent_map.h"
+#include "arena.h"
+#include "compressed_posting_list.h"
 #include "document.h"
+#include "document_bitmap.h"
+#include "document_filter.h"
+#include "metrics.h"
+#include "posting_list.h"
+#include "scorer.h"
 #include "string_processing.h"
+#include "term_dictionary.h"
+#include "thread_pool.h"
+#include "top_documents.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <deque>
 #include <execution>
+#include <functional>
+#include <limits>
 #include <map>
-#include <set>
+#include <memory>
+#include <numeric>
+#include <optional>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <unordered_map>
 #include <vector>
 
 const int MAX_RESULT_DOCUMENT_COUNT = 5;
 
+// How posting lists are kept in memory
+enum class PostingFormat {
+    PLAIN,       // Ordinal and term frequency arrays
+    COMPRESSED,  // Bit-packed blocks with skip entries, several times smaller
+};
+
+// Document frequencies of a collection split between several servers. Scoring a query with them gives
+// every part of the collection the inverse document frequencies of a single server holding all of it
+struct CollectionStatistics {
+    int document_count = 0;
+    uint64_t word_count = 0;  // Words of the live documents, stop words left out
+    std::map<std::string, int, std::less<>> document_freqs;  // Live documents containing a word
+};
+
 class SearchServer {
 public: 
     template <typename StringContainer>
@@ -24,58 +61,342 @@ public:
 
     void AddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
 
+    struct NewDocument {
+        int id;
+        std::string_view text;
+        DocumentStatus status;
+        std::vector<int> ratings;
+    };
+    // Adds all documents or, if any of them is invalid, none. Throws the same errors as AddDocument
+    void AddDocuments(const std::vector<NewDocument>& documents);
+    void AddDocuments(const std::execution::sequenced_policy&, const std::vector<NewDocument>& documents);
+    void AddDocuments(const std::execution::parallel_policy&, const std::vector<NewDocument>& documents);
+
+    // Documents split into words ahead of indexing. Tokenizing reads only the stop words, so it may run
+    // while the server indexes another batch. The batch views the texts, they must outlive it
+    class TokenizedBatch;
+    // Throws std::invalid_argument for documents with invalid words, ids are checked once the batch is added
+    TokenizedBatch TokenizeDocuments(const std::vector<NewDocument>& documents) const;
+    // Same as AddDocuments, the batch is left empty
+    void AddDocuments(const std::execution::parallel_policy&, TokenizedBatch& batch);
+
+    // max_result_count limits how many of the best matches are returned. The filters of document_filter.h
+    // are checked faster than other predicates
     template <typename DocumentPredicate>
-    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate) const;
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate,
+                                           size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
     template <typename ExecutionPolicy, typename DocumentPredicate>
-    std::vector<Document> FindTopDocuments(const ExecutionPolicy& policy, std::string_view raw_query, DocumentPredicate document_predicate) const;
+    std::vector<Document> FindTopDocuments(const ExecutionPolicy& policy, std::string_view raw_query, DocumentPredicate document_predicate,
+                                           size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
 
-    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status) const;
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status,
+                                           size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
     template <typename ExecutionPolicy>
-    std::vector<Document> FindTopDocuments(const ExecutionPolicy& policy, std::string_view raw_query, DocumentStatus status) const;
+    std::vector<Document> FindTopDocuments(const ExecutionPolicy& policy, std::string_view raw_query, DocumentStatus status,
+                                           size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
 
     std::vector<Document> FindTopDocuments(std::string_view raw_query) const;
     template <typename ExecutionPolicy>
     std::vector<Document> FindTopDocuments(const ExecutionPolicy& policy, std::string_view raw_query) const;
 
-    std::set<int>::const_iterator begin() const;
-    std::set<int>::const_iterator end() const;
+    // Page page_number of the ranking split into pages of page_size documents, empty past the last page.
+    // Only the documents up to the end of the page are kept while searching
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocumentsPage(std::string_view raw_query, DocumentPredicate document_predicate,
+                                               size_t page_number, size_t page_size) const;
+    std::vector<Document> FindTopDocumentsPage(std::string_view raw_query, DocumentStatus status, size_t page_number,
+                                               size_t page_size) const;
+    std::vector<Document> FindTopDocumentsPage(std::string_view raw_query, size_t page_number, size_t page_size) const;
+
+    // Scratch memory of a query: parsed words, posting cursors and the result. Consecutive queries through
+    // the same context allocate nothing once it has grown to fit them. A context serves one query at a time
+    class QueryContext;
+
+    // Sequential search through a context, the result lives in the context until its next query
+    template <typename DocumentPredicate>
+    const std::vector<Document>& FindTopDocuments(QueryContext& context, std::string_view raw_query, DocumentPredicate document_predicate,
+                                                  size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    const std::vector<Document>& FindTopDocuments(QueryContext& context, std::string_view raw_query, DocumentStatus status,
+                                                  size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    const std::vector<Document>& FindTopDocuments(QueryContext& context, std::string_view raw_query) const;
+
+    // Result i equals FindTopDocuments(queries[i], status, max_result_count). Every query is evaluated
+    // term-at-a-time into per-thread accumulators, with the MaxScore pruning of the single-query searches,
+    // and queries sharing their longest posting list run next to each other.
+    // Throws std::invalid_argument if any query is invalid
+    std::vector<std::vector<Document>> FindTopDocumentsBatch(ThreadPool& thread_pool, const std::vector<std::string>& queries,
+                                                             DocumentStatus status = DocumentStatus::ACTUAL,
+                                                             size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    std::vector<std::vector<Document>> FindTopDocumentsBatch(const std::vector<std::string>& queries,
+                                                             DocumentStatus status = DocumentStatus::ACTUAL,
+                                                             size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    // Adds the live document count and, for every plus word of the query, the number of live documents
+    // containing it. Throws std::invalid_argument for invalid queries
+    void CollectStatistics(std::string_view raw_query, CollectionStatistics& statistics) const;
+    // Documents hidden from a search, indexed by ordinal: the position of a document in the order of addition.
+    // Adding documents keeps the ordinals, so a mask stays valid as the index grows. Removals may renumber
+    // the documents left once removed ones outnumber them
+    using DocumentMask = DocumentBitmap;
+    // Sequential search scored with collection-wide statistics instead of the local ones.
+    // Documents set in removed_documents are skipped, the mask may be null or shorter than the index
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(const CollectionStatistics& statistics, const DocumentMask* removed_documents,
+                                           std::string_view raw_query, DocumentPredicate document_predicate,
+                                           size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    // Ids of the documents in ascending order
+    class DocumentIdIterator;
+    DocumentIdIterator begin() const;
+    DocumentIdIterator end() const;
     
     using MatchDocumentResult = std::tuple<std::vector<std::string_view>, DocumentStatus>;
     MatchDocumentResult MatchDocument(std::string_view raw_query, int document_id) const;
     MatchDocumentResult MatchDocument(const std::execution::sequenced_policy&, std::string_view raw_query, int document_id) const;
     MatchDocumentResult MatchDocument(const std::execution::parallel_policy&, std::string_view raw_query, int document_id) const;
+    // Sequential match through a context, the result lives in the context until its next query
+    const MatchDocumentResult& MatchDocument(QueryContext& context, std::string_view raw_query, int document_id) const;
+    // Result i matches document_ids[i], the query is parsed once for all of them.
+    // Throws std::out_of_range if any document is unknown
+    std::vector<MatchDocumentResult> MatchDocuments(std::string_view raw_query, const std::vector<int>& document_ids) const;
+    std::vector<MatchDocumentResult> MatchDocuments(const std::execution::parallel_policy&, std::string_view raw_query,
+                                                    const std::vector<int>& document_ids) const;
 
-    const std::map<std::string_view, double>& GetWordFrequencies(int document_id) const;
+#if defined(__cpp_impl_coroutine)
+    // co_await runs the call as a task of the thread pool and resumes the coroutine on the worker, so waiting
+    // queries hold no thread. The server must not change until the coroutine resumes
+    auto FindTopDocumentsAsync(std::string raw_query, DocumentStatus status = DocumentStatus::ACTUAL,
+                               size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    auto MatchDocumentAsync(std::string raw_query, int document_id) const;
+#endif
+
+    // Words of a document with their term frequencies, ordered by term id rather than alphabetically.
+    // A view of the forward index, valid until the server changes
+    class WordFrequencies;
+    // Empty for unknown documents
+    WordFrequencies GetWordFrequencies(int document_id) const;
     int GetDocumentCount() const;
+    bool HasDocument(int document_id) const;
+    // Changes with every added or removed document. Versions are unique across servers, so servers with
+    // equal versions give equal search results, copies included
+    uint64_t GetVersion() const;
+    // Canonical form of a query: sorted and deduplicated plus and minus words without stop words.
+    // Queries with equal keys have equal results. Throws std::invalid_argument for invalid queries
+    std::string GetQueryKey(std::string_view raw_query) const;
+    // Valid until a document is removed. Throws std::out_of_range for unknown documents
+    DocumentOrdinal GetDocumentOrdinal(int document_id) const;
+    // The document as it was added, with its average rating as the only rating. The text views the index.
+    // Throws std::out_of_range for unknown documents
+    NewDocument GetDocument(int document_id) const;
 
     void RemoveDocument(int document_id);
     void RemoveDocument(const std::execution::sequenced_policy&, int document_id);
     void RemoveDocument(const std::execution::parallel_policy&, int document_id);
+    // Removes the documents in one pass over every affected posting list, unknown ids are skipped
+    void RemoveDocuments(const std::vector<int>& document_ids);
+    template <typename ExecutionPolicy>
+    void RemoveDocuments(const ExecutionPolicy& policy, const std::vector<int>& document_ids);
+
+    // Groups of documents with the same set of words, word counts and order aside. Every group holds at least
+    // two ids in ascending order, groups are ordered by their first id. Candidates are found by comparing
+    // word set fingerprints, their word sets are compared to rule out hash collisions
+    std::vector<std::vector<int>> FindDuplicates() const;
+    template <typename ExecutionPolicy>
+    std::vector<std::vector<int>> FindDuplicates(const ExecutionPolicy& policy) const;
+    // Keeps the document with the lowest id of every group of duplicates, returns the removed ids in ascending order
+    std::vector<int> RemoveDuplicates();
+    template <typename ExecutionPolicy>
+    std::vector<int> RemoveDuplicates(const ExecutionPolicy& policy);
+
+    // Searches record their phase timings and traversal counts into the metrics, null stops recording.
+    // The metrics are not owned and must outlive the server and its copies
+    void SetMetrics(SearchMetrics* metrics);
+    SearchMetrics* GetMetrics() const;
+
+    // Parallel searches, indexing, removals and deduplication, batches and async calls run on the pool, null selects
+    // ThreadPool::GetDefault(). Calls with any policy but std::execution::seq count as parallel.
+    // The pool is not owned and must outlive the server and its copies
+    void SetThreadPool(ThreadPool* thread_pool);
+    ThreadPool& GetThreadPool() const;
+
+    // Re-encodes every posting list, search results do not depend on the format
+    void SetPostingFormat(PostingFormat format);
+    PostingFormat GetPostingFormat() const;
+    size_t GetPostingsMemoryUsage() const;
+
+    // Scoring of the searches that follow. Throws std::invalid_argument if k1 is negative or b is out of [0, 1]
+    void SetRanking(const RankingOptions& options);
+    const RankingOptions& GetRanking() const;
 
 private:
+    friend void SaveIndexSnapshot(const SearchServer& search_server, const std::string& path);
+    friend SearchServer OpenIndexSnapshot(const std::string& path);
+
+    // Hot per-document metadata, indexed by ordinal. Removed documents leave a slot with id == -1 until
+    // CompactOrdinals drops it
     struct DocumentData {
+        int id;
         int rating;
         DocumentStatus status;
-        std::string text;  // Store documents texts to create string_views linking to
+    };
+    struct TermCount {
+        TermId term_id;
+        uint32_t count;
+    };
+    struct TermCountRange {
+        const TermCount* first;
+        const TermCount* last;
+
+        const TermCount* begin() const {
+            return first;
+        }
+        const TermCount* end() const {
+            return last;
+        }
+        size_t size() const {
+            return last - first;
+        }
+    };
+    // Cold per-document data, indexed by ordinal. Texts and forward indexes are packed into arenas,
+    // documents opened from a snapshot point into chunks borrowed from the mapped file
+    struct DocumentContent {
+        Arena<char>::Ref text;
+        Arena<TermCount>::Ref terms;  // Forward index, sorted by term id
     };
     const TransparentStringSet stop_words_;
-    std::map<std::string_view, std::map<int, double>> word_to_document_freqs_;
-    std::map<int, std::map<std::string_view, double>> document_to_word_freqs_;
-    std::map<int, DocumentData> documents_;
-    std::set<int> document_ids_;
+    TermDictionary terms_;
+    PostingFormat posting_format_ = PostingFormat::PLAIN;
+    RankingOptions ranking_;
+    SearchMetrics* metrics_ = nullptr;
+    ThreadPool* thread_pool_ = nullptr;
+    // Indexed by TermId, only the container of the current format is filled
+    std::vector<PostingList> postings_;
+    std::vector<CompressedPostingList> compressed_postings_;
+    // Indexed by TermId, log of the posting count. Queries get the IDF as log N - log df without calling log per term
+    std::vector<double> term_log_document_freqs_;
+    std::vector<DocumentData> documents_;
+    // Live documents of every status, status filters skip the others before they are scored
+    static constexpr size_t STATUS_COUNT = 4;
+    std::array<DocumentBitmap, STATUS_COUNT> status_documents_;
+    std::vector<uint32_t> document_word_counts_;  // Indexed by ordinal, postings are scored with term counts and these
+    uint64_t word_count_ = 0;  // Of the live documents
+    Arena<char> document_texts_;
+    Arena<TermCount> document_terms_;
+    std::vector<DocumentContent> document_contents_;
+    // Order-independent hash of the distinct words of a document: XOR of their 128-bit hashes
+    struct WordSetFingerprint {
+        uint64_t low = 0;
+        uint64_t high = 0;
+
+        WordSetFingerprint& operator^=(const WordSetFingerprint& other) {
+            low ^= other.low;
+            high ^= other.high;
+            return *this;
+        }
+        bool operator==(const WordSetFingerprint& other) const {
+            return low == other.low && high == other.high;
+        }
+        bool operator<(const WordSetFingerprint& other) const {
+            return low != other.low ? low < other.low : high < other.high;
+        }
+    };
+    std::vector<WordSetFingerprint> document_fingerprints_;  // Indexed by ordinal
+    size_t released_document_count_ = 0;  // Since the document arenas were last compacted
+    uint64_t version_ = 0;  // Empty servers share version 0
+    std::unordered_map<int, DocumentOrdinal> document_ordinals_;
+    // Ids of the documents sorted by GetEntryId. Ids usually arrive in ascending order and are appended.
+    // Removed ids stay in place as ~id, so a removal is a binary search; CompactOrdinals drops them
+    std::vector<int> document_ids_;
+    // Mapped snapshot file the index was opened from, borrowed postings and contents point into it
+    std::shared_ptr<const void> snapshot_;
+
+    static uint64_t GetNextVersion();
 
     bool IsStopWord(std::string_view word) const;
     static bool IsValidWord(std::string_view word);
     std::vector<std::string_view> SplitIntoWordsNoStop(std::string_view text) const;
     static int ComputeAverageRating(const std::vector<int>& ratings);
 
+    // Document split into words, not yet in the index
+    struct TokenizedDocument {
+        int id;
+        std::string_view text;
+        DocumentStatus status;
+        int rating;
+        std::vector<std::pair<std::string_view, uint32_t>> word_counts;  // Sorted by word
+        uint32_t word_count;
+    };
+    // Smallest part of an AddDocuments batch that gets its own partial index
+    static const size_t MIN_PARALLEL_BATCH_SIZE = 256;
+
+    void CheckNewDocumentId(int document_id) const;
+    // Also rejects ids repeated within the documents
+    template <typename Documents>
+    void CheckNewDocumentIds(const Documents& documents) const;
+    TokenizedDocument TokenizeDocument(int document_id, std::string_view document, DocumentStatus status,
+                                       const std::vector<int>& ratings) const;
+    // Appends the document metadata and returns its ordinal, postings are added separately
+    DocumentOrdinal AddDocumentData(const TokenizedDocument& document);
+    void AddDocumentContent(const TokenizedDocument& document);
+    template <typename ExecutionPolicy>
+    void AddTokenizedDocuments(const ExecutionPolicy& policy, std::vector<TokenizedDocument>& documents);
+
+    // Every policy but std::execution::seq runs on the thread pool
+    template <typename ExecutionPolicy>
+    static constexpr bool IS_SEQUENCED_POLICY = std::is_same_v<std::decay_t<ExecutionPolicy>, std::execution::sequenced_policy>;
+    // Calls function(begin, end) for chunks of at most grain_size indexes covering [0, count)
+    template <typename ExecutionPolicy, typename Function>
+    void ForEachChunk(const ExecutionPolicy& policy, size_t count, size_t grain_size, Function function) const;
+    template <typename ExecutionPolicy, typename Iterator, typename Compare = std::less<>>
+    void Sort(const ExecutionPolicy& policy, Iterator first, Iterator last, Compare compare = {}) const;
+
+    TermId InternTerm(std::string_view word);
+    // Finds a term contained in at least one live document
+    std::optional<TermId> FindTerm(std::string_view word) const;
+    size_t GetDocumentFreq(TermId term_id) const;
+    const PostingBound& GetPostingBound(TermId term_id) const;
+    void AppendPosting(TermId term_id, DocumentOrdinal ordinal, uint32_t term_count);
+    // Erases the posting of a document, term_count is the one it was appended with
+    void ErasePosting(TermId term_id, DocumentOrdinal ordinal, uint32_t term_count);
+    // Refreshes the stored log document frequency once the postings of a term have changed
+    void UpdateTermStatistics(TermId term_id);
+    CompressedPostingList CompressPostings(const PostingList& postings) const;
+    // Cursor over postings with ordinals in [range_begin, range_end), Cursor must match the current format
+    template <typename Cursor>
+    Cursor OpenCursor(TermId term_id, DocumentOrdinal range_begin, DocumentOrdinal range_end) const;
+    std::string_view GetDocumentText(DocumentOrdinal ordinal) const;
+    TermCountRange GetDocumentTerms(DocumentOrdinal ordinal) const;
+    static WordSetFingerprint ComputeWordFingerprint(std::string_view word);
+    bool HasSameWords(DocumentOrdinal lhs, DocumentOrdinal rhs) const;
+    // Erases the postings of the sorted ordinals [first, last)
+    void ErasePostings(TermId term_id, const DocumentOrdinal* first, const DocumentOrdinal* last);
+    // Frees the document slot once its postings are gone
+    void ReleaseDocument(DocumentOrdinal ordinal);
+    static int GetEntryId(int entry) {
+        return entry < 0 ? ~entry : entry;
+    }
+    // The entry of the id in document_ids_, which may be removed, or the position to insert it at
+    std::vector<int>::iterator FindIdEntry(int document_id);
+    // Released documents leave garbage in the arenas, they are compacted once it outweighs the live contents
+    static constexpr size_t MIN_RELEASED_DOCUMENTS_TO_COMPACT = 1024;
+    void CompactDocumentContents();
+    // Released documents keep their slots until they outnumber the live ones. Then the live documents get
+    // dense ordinals in the same order, so every posting list stays sorted as it is remapped
+    static constexpr size_t MIN_RELEASED_SLOTS_TO_COMPACT = 1024;
+    template <typename ExecutionPolicy>
+    void CompactOrdinals(const ExecutionPolicy& policy);
+    void RemapPostings(TermId term_id, const std::vector<DocumentOrdinal>& new_ordinals);
+    // Moves the live documents to their new ordinals, postings must be remapped first
+    void CompactDocuments(const std::vector<DocumentOrdinal>& new_ordinals);
+
     struct QueryWord {
         std::string_view data;
         bool is_minus;
         bool is_stop;
     };
 
-    QueryWord ParseQueryWord(std::string_view text) const;
+    // is_valid tells whether the word is free of control characters, see ForEachWord
+    QueryWord ParseQueryWord(std::string_view text, bool is_valid) const;
 
     struct Query {
         std::vector<std::string_view> plus_words;
@@ -83,16 +404,291 @@ private:
     };
 
     Query ParseQuery(std::string_view text, bool skip_sort = false) const;
+    // Same, reusing the memory of result
+    void ParseQuery(std::string_view text, Query& result, bool skip_sort = false) const;
 
-    // Existence required
-    double ComputeWordInverseDocumentFreq(std::string_view word) const;
+    // Query words known to the index as sorted term ids, matched against the forward index of a document
+    struct MatchQuery {
+        std::vector<TermId> plus_terms;
+        std::vector<TermId> minus_terms;
+    };
+    void PrepareMatchQuery(const Query& query, MatchQuery& result) const;
+    // Gallops through the term ids of the document, result gets the matched words in alphabetical order
+    void MatchTerms(const MatchQuery& query, DocumentOrdinal ordinal, std::vector<std::string_view>& matched_words) const;
+
+    struct ScoredTerm {
+        TermId term_id;
+        double weight;  // Given by the scorer, the inverse document frequency for TF-IDF
+        double upper_bound;  // No posting of the term scores higher
+    };
 
+    // Query terms resolved against the index, shared by every evaluated ordinal range
+    struct PreparedQuery {
+        RankingOptions ranking;
+        double average_word_count = 0.0;
+        std::vector<ScoredTerm> plus_terms;  // Ordered by upper bound
+        std::vector<double> bound_prefix;  // bound_prefix[i] is the best score plus_terms [0, i) can add together
+        std::vector<TermId> minus_terms;
+        // Candidates must be in allowed_documents and out of removed_documents when these are set,
+        // they point to bitmaps of the caller and are used as they are
+        const DocumentBitmap* allowed_documents = nullptr;
+        const DocumentBitmap* removed_documents = nullptr;
+        // Documents containing a minus word, set only if has_excluded_documents. Sized by the last of them
+        DocumentBitmap excluded_documents;
+        bool has_excluded_documents = false;
+    };
+
+    // Ordinal ranges smaller than this are not worth a separate parallel task
+    static const DocumentOrdinal MIN_PARALLEL_RANGE_SIZE = 16384;
+    // Queries of a batch parsed and prepared together, bounds the memory of the prepared queries
+    static constexpr size_t BATCH_WINDOW_SIZE = 4096;
+
+    // Statistics, when given, replace the local document frequencies
+    void PrepareQuery(const Query& query, PreparedQuery& result, const CollectionStatistics* statistics = nullptr) const;
+    // Sets the filters of a prepared query and builds its excluded documents from the minus word postings.
+    // Either bitmap may be null, both must outlive the evaluation of the query
+    void PrepareFilter(PreparedQuery& query, const DocumentBitmap* allowed_documents, const DocumentBitmap* removed_documents) const;
+    // Bitmap of the live documents with the status, null for statuses out of the enum
+    const DocumentBitmap* GetStatusDocuments(DocumentStatus status) const;
+
+    template <typename Cursor>
+    struct CursorBuffers {
+        std::vector<Cursor> plus_cursors;
+        std::vector<double> block_bounds;
+        std::vector<double> block_bound_prefix;
+    };
+    // Cursor buffers of both posting formats, reused by consecutive evaluations
+    using CursorStorage = std::tuple<CursorBuffers<PostingList::Cursor>, CursorBuffers<CompressedPostingList::Cursor>>;
+
+    // Per-thread state of the batch queries. Scores are reset in constant time by bumping the stamp
+    struct BatchAccumulator {
+        // A score is set when its stamp becomes the current one, so the scores are left uninitialized
+        std::unique_ptr<double[]> scores;
+        std::vector<uint32_t> stamps;
+        uint32_t stamp = 0;
+        std::vector<DocumentOrdinal> touched_ordinals;  // Accumulated documents that pass the filters
+        std::vector<double> top_scores;
+        std::vector<ScoredTerm> terms;
+        std::vector<double> remaining_bounds;
+        CursorStorage cursor_storage;
+        TopDocuments top_documents{0};
+    };
+    template <typename Cursor, typename Scorer>
+    void EvaluateBatchQuery(const PreparedQuery& query, const Scorer& scorer, DocumentStatus status, size_t max_result_count,
+                            BatchAccumulator& accumulator, std::vector<Document>& result) const;
+
+    // Evaluates the query over ordinals [range_begin, range_end) and pushes matches into top_documents.
+    // shared_threshold, when given, is raised to this range's admission threshold and read back for pruning
+    template <typename DocumentPredicate>
+    void FindDocumentsInRange(const PreparedQuery& query, DocumentPredicate document_predicate,
+                              DocumentOrdinal range_begin, DocumentOrdinal range_end,
+                              TopDocuments& top_documents, std::atomic<double>* shared_threshold,
+                              CursorStorage& cursor_storage) const;
+    template <typename Cursor, typename Scorer, typename DocumentPredicate>
+    void EvaluateRange(const PreparedQuery& query, const Scorer& scorer, DocumentPredicate document_predicate,
+                       DocumentOrdinal range_begin, DocumentOrdinal range_end,
+                       TopDocuments& top_documents, std::atomic<double>* shared_threshold,
+                       CursorBuffers<Cursor>& buffers) const;
+
+    // Scores every matched document and keeps the best max_result_count of them
     template <typename DocumentPredicate>
-    std::vector<Document> FindAllDocuments(const Query& query, DocumentPredicate document_predicate) const;
+    TopDocuments FindAllDocuments(const Query& query, DocumentPredicate document_predicate, size_t max_result_count,
+                                  const DocumentBitmap* allowed_documents = nullptr) const;
+    // Calls function(filter, allowed_documents) with the predicate or, if it can be, with its bitmap and NoFilter
+    template <typename DocumentPredicate, typename Function>
+    decltype(auto) ResolveFilter(DocumentPredicate document_predicate, Function function) const;
+    // Context search limited to allowed_documents unless it is null
     template <typename DocumentPredicate>
-    std::vector<Document> FindAllDocuments(const std::execution::sequenced_policy&, const Query& query, DocumentPredicate document_predicate) const;
+    const std::vector<Document>& FindContextDocuments(QueryContext& context, std::string_view raw_query,
+                                                      DocumentPredicate document_predicate, size_t max_result_count,
+                                                      const DocumentBitmap* allowed_documents) const;
+    // The phases after parsing end on the timer
     template <typename DocumentPredicate>
-    std::vector<Document> FindAllDocuments(const std::execution::parallel_policy&, const Query& query, DocumentPredicate document_predicate) const;
+    TopDocuments FindAllDocuments(const std::execution::sequenced_policy&, const Query& query, DocumentPredicate document_predicate,
+                                  size_t max_result_count, const DocumentBitmap* allowed_documents,
+                                  SearchMetrics::QueryTimer& timer) const;
+    template <typename DocumentPredicate>
+    TopDocuments FindAllDocuments(const std::execution::parallel_policy&, const Query& query, DocumentPredicate document_predicate,
+                                  size_t max_result_count, const DocumentBitmap* allowed_documents,
+                                  SearchMetrics::QueryTimer& timer) const;
+};
+
+class SearchServer::TokenizedBatch {
+public:
+    size_t size() const {
+        return documents_.size();
+    }
+
+private:
+    friend class SearchServer;
+
+    std::vector<TokenizedDocument> documents_;
+};
+
+class SearchServer::QueryContext {
+private:
+    friend class SearchServer;
+
+    Query query_;
+    PreparedQuery prepared_query_;
+    CursorStorage cursor_storage_;
+    TopDocuments top_documents_{0};
+    std::vector<Document> documents_;
+    MatchQuery match_query_;
+    MatchDocumentResult match_result_;
+};
+
+// Skips the removed ids, which stay in the sorted entries until the ordinals are compacted
+class SearchServer::DocumentIdIterator {
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = int;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const int*;
+    using reference = const int&;
+
+    DocumentIdIterator() = default;
+
+    const int& operator*() const {
+        return *entry_;
+    }
+
+    const int* operator->() const {
+        return entry_;
+    }
+
+    DocumentIdIterator& operator++() {
+        ++entry_;
+        SkipRemoved();
+        return *this;
+    }
+
+    DocumentIdIterator operator++(int) {
+        DocumentIdIterator result = *this;
+        ++*this;
+        return result;
+    }
+
+    bool operator==(const DocumentIdIterator& other) const {
+        return entry_ == other.entry_;
+    }
+
+    bool operator!=(const DocumentIdIterator& other) const {
+        return entry_ != other.entry_;
+    }
+
+private:
+    friend class SearchServer;
+
+    const int* entry_ = nullptr;
+    const int* last_ = nullptr;
+
+    DocumentIdIterator(const int* entry, const int* last)
+        : entry_(entry)
+        , last_(last) {
+        SkipRemoved();
+    }
+
+    void SkipRemoved() {
+        while (entry_ != last_ && *entry_ < 0) {
+            ++entry_;
+        }
+    }
+};
+
+class SearchServer::WordFrequencies {
+public:
+    class Iterator {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = std::pair<std::string_view, double>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const value_type*;
+        using reference = const value_type&;
+
+        // The pair lives in the iterator until it moves
+        const value_type& operator*() const {
+            value_ = {(*terms_)[term_->term_id], term_->count * inv_word_count_};
+            return value_;
+        }
+
+        const value_type* operator->() const {
+            return &**this;
+        }
+
+        Iterator& operator++() {
+            ++term_;
+            return *this;
+        }
+
+        Iterator operator++(int) {
+            Iterator result = *this;
+            ++term_;
+            return result;
+        }
+
+        bool operator==(const Iterator& other) const {
+            return term_ == other.term_;
+        }
+
+        bool operator!=(const Iterator& other) const {
+            return term_ != other.term_;
+        }
+
+    private:
+        friend class WordFrequencies;
+
+        const TermCount* term_ = nullptr;
+        const TermDictionary* terms_ = nullptr;
+        double inv_word_count_ = 0.0;
+        mutable value_type value_;
+    };
+
+    Iterator begin() const {
+        return MakeIterator(terms_.begin());
+    }
+
+    Iterator end() const {
+        return MakeIterator(terms_.end());
+    }
+
+    size_t size() const {
+        return terms_.size();
+    }
+
+    bool empty() const {
+        return terms_.size() == 0;
+    }
+
+    // The pair of the word, or end() if the document does not contain it. A binary search over the forward index
+    Iterator Find(std::string_view word) const {
+        if (dictionary_ == nullptr) {
+            return end();
+        }
+        const std::optional<TermId> term_id = dictionary_->Find(word);
+        if (!term_id) {
+            return end();
+        }
+        const TermCount* term = std::lower_bound(terms_.begin(), terms_.end(), *term_id, [](const TermCount& term, TermId id) {
+            return term.term_id < id;
+        });
+        return term != terms_.end() && term->term_id == *term_id ? MakeIterator(term) : end();
+    }
+
+private:
+    friend class SearchServer;
+
+    TermCountRange terms_{nullptr, nullptr};
+    const TermDictionary* dictionary_ = nullptr;
+    double inv_word_count_ = 0.0;
+
+    Iterator MakeIterator(const TermCount* term) const {
+        Iterator iterator;
+        iterator.term_ = term;
+        iterator.terms_ = dictionary_;
+        iterator.inv_word_count_ = inv_word_count_;
+        return iterator;
+    }
 };
 
 template <typename StringContainer>
@@ -108,10 +704,9 @@ SearchServer::SearchServer(const StringContainer& stop_words)
 }
 
 template <typename ExecutionPolicy>
-std::vector<Document> SearchServer::FindTopDocuments(const ExecutionPolicy& policy, std::string_view raw_query, DocumentStatus status) const {
-    return FindTopDocuments(policy, raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
-        return document_status == status;
-    });
+std::vector<Document> SearchServer::FindTopDocuments(const ExecutionPolicy& policy, std::string_view raw_query, DocumentStatus status,
+                                                     size_t max_result_count) const {
+    return FindTopDocuments(policy, raw_query, StatusFilter{status}, max_result_count);
 }
 
 template <typename ExecutionPolicy>
@@ -120,103 +715,647 @@ std::vector<Document> SearchServer::FindTopDocuments(const ExecutionPolicy& poli
 }
 
 template <typename ExecutionPolicy, typename DocumentPredicate>
-std::vector<Document> SearchServer::FindTopDocuments(const ExecutionPolicy& policy, std::string_view raw_query, DocumentPredicate document_predicate) const {
+std::vector<Document> SearchServer::FindTopDocuments(const ExecutionPolicy& policy, std::string_view raw_query, DocumentPredicate document_predicate,
+                                                     size_t max_result_count) const {
+    SearchMetrics::QueryTimer timer(metrics_);
     const auto query = ParseQuery(raw_query);
 
-    auto matched_documents = FindAllDocuments(policy, query, document_predicate);
+    auto top_documents = ResolveFilter(document_predicate, [&](auto filter, const DocumentBitmap* allowed_documents) {
+        return FindAllDocuments(policy, query, filter, max_result_count, allowed_documents, timer);
+    });
+    auto documents = top_documents.ExtractSorted();
+    timer.EndPhase(SearchPhase::RESULT);
+    return documents;
+}
 
-    std::sort(matched_documents.begin(), matched_documents.end(), [](const Document& lhs, const Document& rhs) {
-        if (std::abs(lhs.relevance - rhs.relevance) < 1e-6) {
-            return lhs.rating > rhs.rating;
-        } else {
-            return lhs.relevance > rhs.relevance;
-        }
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate,
+                                                     size_t max_result_count) const {
+    return FindTopDocuments(std::execution::seq, raw_query, document_predicate, max_result_count);
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocumentsPage(std::string_view raw_query, DocumentPredicate document_predicate,
+                                                         size_t page_number, size_t page_size) const {
+    const size_t page_begin = page_number <= std::numeric_limits<size_t>::max() / std::max<size_t>(1, page_size)
+                                  ? page_number * page_size
+                                  : std::numeric_limits<size_t>::max();
+    const size_t page_end = page_begin + std::min(page_size, std::numeric_limits<size_t>::max() - page_begin);
+    std::vector<Document> documents = FindTopDocuments(raw_query, document_predicate, page_end);
+    documents.erase(documents.begin(), documents.begin() + std::min(page_begin, documents.size()));
+    return documents;
+}
+
+template <typename DocumentPredicate>
+const std::vector<Document>& SearchServer::FindTopDocuments(QueryContext& context, std::string_view raw_query,
+                                                            DocumentPredicate document_predicate, size_t max_result_count) const {
+    return ResolveFilter(document_predicate, [&](auto filter, const DocumentBitmap* allowed_documents) -> const std::vector<Document>& {
+        return FindContextDocuments(context, raw_query, filter, max_result_count, allowed_documents);
     });
-    if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
-        matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
-    }
+}
+
+template <typename DocumentPredicate>
+const std::vector<Document>& SearchServer::FindContextDocuments(QueryContext& context, std::string_view raw_query,
+                                                                DocumentPredicate document_predicate, size_t max_result_count,
+                                                                const DocumentBitmap* allowed_documents) const {
+    SearchMetrics::QueryTimer timer(metrics_);
+    ParseQuery(raw_query, context.query_);
+    PrepareQuery(context.query_, context.prepared_query_);
+    timer.EndPhase(SearchPhase::PARSE);
+    PrepareFilter(context.prepared_query_, allowed_documents, nullptr);
+    timer.EndPhase(SearchPhase::FILTER);
+    context.top_documents_.Reset(max_result_count);
+    FindDocumentsInRange(context.prepared_query_, document_predicate, 0, documents_.size(), context.top_documents_, nullptr,
+                         context.cursor_storage_);
+    timer.EndPhase(SearchPhase::TRAVERSAL);
+    context.top_documents_.ExtractSorted(context.documents_);
+    timer.EndPhase(SearchPhase::RESULT);
+    return context.documents_;
+}
+
+#if defined(__cpp_impl_coroutine)
+inline auto SearchServer::FindTopDocumentsAsync(std::string raw_query, DocumentStatus status, size_t max_result_count) const {
+    return GetThreadPool().Schedule([this, raw_query = std::move(raw_query), status, max_result_count]() {
+        // Worker threads live across calls, so their contexts are warm after the first few queries
+        thread_local QueryContext context;
+        return FindTopDocuments(context, raw_query, status, max_result_count);
+    });
+}
 
-    return matched_documents;
+inline auto SearchServer::MatchDocumentAsync(std::string raw_query, int document_id) const {
+    return GetThreadPool().Schedule([this, raw_query = std::move(raw_query), document_id]() {
+        thread_local QueryContext context;
+        return MatchDocument(context, raw_query, document_id);
+    });
 }
+#endif
 
 template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate) const {
-    return FindTopDocuments(std::execution::seq, raw_query, document_predicate);
+std::vector<Document> SearchServer::FindTopDocuments(const CollectionStatistics& statistics, const DocumentMask* removed_documents,
+                                                     std::string_view raw_query, DocumentPredicate document_predicate,
+                                                     size_t max_result_count) const {
+    SearchMetrics::QueryTimer timer(metrics_);
+    PreparedQuery prepared_query;
+    PrepareQuery(ParseQuery(raw_query), prepared_query, &statistics);
+    timer.EndPhase(SearchPhase::PARSE);
+    return ResolveFilter(document_predicate, [&](auto filter, const DocumentBitmap* allowed_documents) {
+        PrepareFilter(prepared_query, allowed_documents, removed_documents);
+        timer.EndPhase(SearchPhase::FILTER);
+        TopDocuments top_documents(max_result_count);
+        CursorStorage cursor_storage;
+        FindDocumentsInRange(prepared_query, filter, 0, documents_.size(), top_documents, nullptr, cursor_storage);
+        timer.EndPhase(SearchPhase::TRAVERSAL);
+        auto documents = top_documents.ExtractSorted();
+        timer.EndPhase(SearchPhase::RESULT);
+        return documents;
+    });
 }
 
 template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindAllDocuments(const std::execution::sequenced_policy&, const Query& query, DocumentPredicate document_predicate) const {
-    std::map<int, double> document_to_relevance;
-    for (std::string_view word : query.plus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
+TopDocuments SearchServer::FindAllDocuments(const std::execution::sequenced_policy&, const Query& query, DocumentPredicate document_predicate,
+                                            size_t max_result_count, const DocumentBitmap* allowed_documents,
+                                            SearchMetrics::QueryTimer& timer) const {
+    PreparedQuery prepared_query;
+    PrepareQuery(query, prepared_query);
+    timer.EndPhase(SearchPhase::PARSE);
+    PrepareFilter(prepared_query, allowed_documents, nullptr);
+    timer.EndPhase(SearchPhase::FILTER);
+    TopDocuments top_documents(max_result_count);
+    CursorStorage cursor_storage;
+    FindDocumentsInRange(prepared_query, document_predicate, 0, documents_.size(), top_documents, nullptr, cursor_storage);
+    timer.EndPhase(SearchPhase::TRAVERSAL);
+    return top_documents;
+}
+
+template <typename DocumentPredicate>
+TopDocuments SearchServer::FindAllDocuments(const Query& query, DocumentPredicate document_predicate, size_t max_result_count,
+                                            const DocumentBitmap* allowed_documents) const {
+    SearchMetrics::QueryTimer timer(metrics_);
+    return FindAllDocuments(std::execution::seq, query, document_predicate, max_result_count, allowed_documents, timer);
+}
+
+// The ordinal space is split into ranges evaluated independently, so even a single word query uses every core.
+// Ranges publish their admission thresholds to each other: a document that loses to the K best of any range
+// cannot get into the merged top
+template <typename DocumentPredicate>
+TopDocuments SearchServer::FindAllDocuments(const std::execution::parallel_policy&, const Query& query, DocumentPredicate document_predicate,
+                                            size_t max_result_count, const DocumentBitmap* allowed_documents,
+                                            SearchMetrics::QueryTimer& timer) const {
+    PreparedQuery prepared_query;
+    PrepareQuery(query, prepared_query);
+    timer.EndPhase(SearchPhase::PARSE);
+    PrepareFilter(prepared_query, allowed_documents, nullptr);
+    timer.EndPhase(SearchPhase::FILTER);
+    const DocumentOrdinal ordinal_count = documents_.size();
+    ThreadPool& thread_pool = GetThreadPool();
+    const size_t max_range_count = thread_pool.GetThreadCount() * 4;
+    const size_t range_count = std::clamp<size_t>(ordinal_count / MIN_PARALLEL_RANGE_SIZE, 1, max_range_count);
+
+    std::vector<TopDocuments> range_top_documents(range_count, TopDocuments(max_result_count));
+    std::atomic<double> shared_threshold = -std::numeric_limits<double>::infinity();
+    thread_pool.ParallelFor(range_count, 1, [&](size_t begin, size_t end) {
+        CursorStorage cursor_storage;
+        for (size_t range = begin; range < end; ++range) {
+            const auto range_begin = static_cast<DocumentOrdinal>(uint64_t{ordinal_count} * range / range_count);
+            const auto range_end = static_cast<DocumentOrdinal>(uint64_t{ordinal_count} * (range + 1) / range_count);
+            FindDocumentsInRange(prepared_query, document_predicate, range_begin, range_end,
+                                 range_top_documents[range], &shared_threshold, cursor_storage);
         }
-        const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-        for (const auto [document_id, term_freq] : word_to_document_freqs_.at(word)) {
-            const auto& document_data = documents_.at(document_id);
-            if (document_predicate(document_id, document_data.status, document_data.rating)) {
-                document_to_relevance[document_id] += term_freq * inverse_document_freq;
-            }
+    });
+    timer.EndPhase(SearchPhase::TRAVERSAL);
+
+    TopDocuments top_documents(max_result_count);
+    for (const TopDocuments& range_top : range_top_documents) {
+        top_documents.Merge(range_top);
+    }
+    timer.EndPhase(SearchPhase::TOP_K);
+    return top_documents;
+}
+
+template <typename ExecutionPolicy, typename Function>
+void SearchServer::ForEachChunk(const ExecutionPolicy&, size_t count, size_t grain_size, Function function) const {
+    if constexpr (IS_SEQUENCED_POLICY<ExecutionPolicy>) {
+        for (size_t begin = 0; begin < count; begin += grain_size) {
+            function(begin, std::min(count, begin + grain_size));
         }
+    } else {
+        GetThreadPool().ParallelFor(count, grain_size, std::move(function));
     }
+}
 
-    for (std::string_view word : query.minus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
+template <typename ExecutionPolicy, typename Iterator, typename Compare>
+void SearchServer::Sort(const ExecutionPolicy&, Iterator first, Iterator last, Compare compare) const {
+    if constexpr (IS_SEQUENCED_POLICY<ExecutionPolicy>) {
+        std::sort(first, last, compare);
+    } else {
+        GetThreadPool().Sort(first, last, compare);
+    }
+}
+
+template <typename ExecutionPolicy>
+void SearchServer::RemoveDocuments(const ExecutionPolicy& policy, const std::vector<int>& document_ids) {
+    std::vector<DocumentOrdinal> ordinals;
+    ordinals.reserve(document_ids.size());
+    for (const int document_id : document_ids) {
+        if (const auto it = document_ordinals_.find(document_id); it != document_ordinals_.end()) {
+            ordinals.push_back(it->second);
         }
-        for (const auto [document_id, _] : word_to_document_freqs_.at(word)) {
-            document_to_relevance.erase(document_id);
+    }
+    std::sort(ordinals.begin(), ordinals.end());
+    ordinals.erase(std::unique(ordinals.begin(), ordinals.end()), ordinals.end());
+
+    // Postings to erase grouped by term, every posting list is then rewritten once
+    std::vector<std::pair<TermId, DocumentOrdinal>> postings;
+    for (const DocumentOrdinal ordinal : ordinals) {
+        for (const TermCount& term : GetDocumentTerms(ordinal)) {
+            postings.emplace_back(term.term_id, ordinal);
+        }
+    }
+    Sort(policy, postings.begin(), postings.end());
+    std::vector<DocumentOrdinal> erased_ordinals(postings.size());
+    std::vector<std::pair<TermId, size_t>> term_begins;
+    for (size_t i = 0; i < postings.size(); ++i) {
+        erased_ordinals[i] = postings[i].second;
+        if (term_begins.empty() || term_begins.back().first != postings[i].first) {
+            term_begins.emplace_back(postings[i].first, i);
         }
     }
+    // Every word owns a separate posting list, so they can be updated concurrently
+    ForEachChunk(policy, term_begins.size(), 16, [this, &term_begins, &erased_ordinals](size_t begin, size_t end) {
+        for (size_t term_number = begin; term_number < end; ++term_number) {
+            const size_t postings_end = term_number + 1 < term_begins.size() ? term_begins[term_number + 1].second
+                                                                             : erased_ordinals.size();
+            ErasePostings(term_begins[term_number].first, erased_ordinals.data() + term_begins[term_number].second,
+                          erased_ordinals.data() + postings_end);
+        }
+    });
 
-    std::vector<Document> matched_documents;
-    for (const auto [document_id, relevance] : document_to_relevance) {
-        matched_documents.push_back({document_id, relevance, documents_.at(document_id).rating});
+    for (const DocumentOrdinal ordinal : ordinals) {
+        ReleaseDocument(ordinal);
     }
-    return matched_documents;
+    CompactOrdinals(policy);
 }
 
-template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindAllDocuments(const Query& query, DocumentPredicate document_predicate) const {
-    return FindAllDocuments(std::execution::seq, query, document_predicate);
+template <typename ExecutionPolicy>
+void SearchServer::CompactOrdinals(const ExecutionPolicy& policy) {
+    const size_t live_count = document_ordinals_.size();
+    if (documents_.size() - live_count < std::max(MIN_RELEASED_SLOTS_TO_COMPACT, live_count)) {
+        return;
+    }
+    // Released slots get the ordinal of the next live document, no posting refers to them
+    std::vector<DocumentOrdinal> new_ordinals(documents_.size());
+    DocumentOrdinal next_ordinal = 0;
+    for (size_t ordinal = 0; ordinal < documents_.size(); ++ordinal) {
+        new_ordinals[ordinal] = next_ordinal;
+        if (documents_[ordinal].id != -1) {
+            ++next_ordinal;
+        }
+    }
+    // Every word owns a separate posting list, so they can be remapped concurrently
+    ForEachChunk(policy, term_log_document_freqs_.size(), 64, [this, &new_ordinals](size_t begin, size_t end) {
+        for (size_t term_id = begin; term_id < end; ++term_id) {
+            RemapPostings(static_cast<TermId>(term_id), new_ordinals);
+        }
+    });
+    CompactDocuments(new_ordinals);
+}
+
+template <typename ExecutionPolicy>
+std::vector<std::vector<int>> SearchServer::FindDuplicates(const ExecutionPolicy& policy) const {
+    struct Candidate {
+        WordSetFingerprint fingerprint;
+        int id;
+        DocumentOrdinal ordinal;
+    };
+    std::vector<Candidate> candidates;
+    candidates.reserve(document_ordinals_.size());
+    for (const auto& [document_id, ordinal] : document_ordinals_) {
+        candidates.push_back({document_fingerprints_[ordinal], document_id, ordinal});
+    }
+    Sort(policy, candidates.begin(), candidates.end(), [](const Candidate& lhs, const Candidate& rhs) {
+        return lhs.fingerprint < rhs.fingerprint || (lhs.fingerprint == rhs.fingerprint && lhs.id < rhs.id);
+    });
+
+    // Runs of equal fingerprints hold the duplicates, plus the rare documents that only share the hash
+    std::vector<std::pair<size_t, size_t>> runs;
+    for (size_t begin = 0, end = 0; begin < candidates.size(); begin = end) {
+        while (end < candidates.size() && candidates[end].fingerprint == candidates[begin].fingerprint) {
+            ++end;
+        }
+        if (end - begin > 1) {
+            runs.emplace_back(begin, end);
+        }
+    }
+    std::vector<std::vector<std::vector<int>>> run_groups(runs.size());
+    ForEachChunk(policy, runs.size(), 16, [this, &candidates, &runs, &run_groups](size_t begin, size_t end) {
+        std::vector<DocumentOrdinal> group_ordinals;
+        for (size_t run_number = begin; run_number < end; ++run_number) {
+            group_ordinals.clear();
+            auto& groups = run_groups[run_number];
+            for (size_t i = runs[run_number].first; i < runs[run_number].second; ++i) {
+                size_t group = 0;
+                while (group < groups.size() && !HasSameWords(group_ordinals[group], candidates[i].ordinal)) {
+                    ++group;
+                }
+                if (group == groups.size()) {
+                    group_ordinals.push_back(candidates[i].ordinal);
+                    groups.emplace_back();
+                }
+                groups[group].push_back(candidates[i].id);
+            }
+        }
+    });
+
+    std::vector<std::vector<int>> result;
+    for (auto& groups : run_groups) {
+        for (auto& group : groups) {
+            if (group.size() > 1) {
+                result.push_back(std::move(group));
+            }
+        }
+    }
+    std::sort(result.begin(), result.end(), [](const std::vector<int>& lhs, const std::vector<int>& rhs) {
+        return lhs.front() < rhs.front();
+    });
+    return result;
+}
+
+template <typename ExecutionPolicy>
+std::vector<int> SearchServer::RemoveDuplicates(const ExecutionPolicy& policy) {
+    std::vector<int> duplicate_ids;
+    for (const std::vector<int>& group : FindDuplicates(policy)) {
+        duplicate_ids.insert(duplicate_ids.end(), group.begin() + 1, group.end());
+    }
+    std::sort(duplicate_ids.begin(), duplicate_ids.end());
+    RemoveDocuments(policy, duplicate_ids);
+    return duplicate_ids;
+}
+
+template <>
+inline PostingList::Cursor SearchServer::OpenCursor<PostingList::Cursor>(TermId term_id, DocumentOrdinal range_begin,
+                                                                         DocumentOrdinal range_end) const {
+    return PostingList::Cursor(postings_[term_id], document_word_counts_.data(), range_begin, range_end);
+}
+
+template <>
+inline CompressedPostingList::Cursor SearchServer::OpenCursor<CompressedPostingList::Cursor>(TermId term_id, DocumentOrdinal range_begin,
+                                                                                             DocumentOrdinal range_end) const {
+    return CompressedPostingList::Cursor(compressed_postings_[term_id], document_word_counts_.data(), range_begin, range_end);
+}
+
+template <typename DocumentPredicate, typename Function>
+decltype(auto) SearchServer::ResolveFilter(DocumentPredicate document_predicate, Function function) const {
+    if constexpr (std::is_same_v<DocumentPredicate, StatusFilter>) {
+        // Statuses out of the enum have no bitmap, their documents are checked one by one
+        if (const DocumentBitmap* status_documents = GetStatusDocuments(document_predicate.status)) {
+            return function(NoFilter{}, status_documents);
+        }
+    }
+    return function(document_predicate, nullptr);
 }
 
 template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindAllDocuments(const std::execution::parallel_policy&, const Query& query, DocumentPredicate document_predicate) const {
-    ConcurrentMap<int, double> document_to_relevance(97);
-    for_each(
-        std::execution::par,
-        query.plus_words.begin(), query.plus_words.end(),
-        [this, document_predicate, &document_to_relevance](std::string_view word) {
-            if (word_to_document_freqs_.count(word) == 0) {
-                return;
+void SearchServer::FindDocumentsInRange(const PreparedQuery& query, DocumentPredicate document_predicate,
+                                        DocumentOrdinal range_begin, DocumentOrdinal range_end,
+                                        TopDocuments& top_documents, std::atomic<double>* shared_threshold,
+                                        CursorStorage& cursor_storage) const {
+    using CompressedCursor = CompressedPostingList::Cursor;
+    using PlainCursor = PostingList::Cursor;
+    VisitScorer(query.ranking, query.average_word_count, [&](const auto& scorer) {
+        if (posting_format_ == PostingFormat::COMPRESSED) {
+            EvaluateRange<CompressedCursor>(query, scorer, document_predicate, range_begin, range_end, top_documents, shared_threshold,
+                                            std::get<CursorBuffers<CompressedCursor>>(cursor_storage));
+        } else {
+            EvaluateRange<PlainCursor>(query, scorer, document_predicate, range_begin, range_end, top_documents, shared_threshold,
+                                       std::get<CursorBuffers<PlainCursor>>(cursor_storage));
+        }
+    });
+}
+
+// Term-at-a-time MaxScore evaluation of a batch query. Posting lists are scanned from the shortest one, every
+// posting adds to the accumulator of its document. Once the bounds of the terms left cannot lift a new document
+// over the k-th best accumulated score, their lists are no longer scanned: they are only probed for the
+// accumulated documents that may still get into the top
+template <typename Cursor, typename Scorer>
+void SearchServer::EvaluateBatchQuery(const PreparedQuery& query, const Scorer& scorer, DocumentStatus status,
+                                      size_t max_result_count, BatchAccumulator& accumulator, std::vector<Document>& result) const {
+    result.clear();
+    if (max_result_count == 0) {
+        return;
+    }
+    const DocumentOrdinal ordinal_count = static_cast<DocumentOrdinal>(documents_.size());
+    auto& scores = accumulator.scores;
+    auto& stamps = accumulator.stamps;
+    if (stamps.size() < ordinal_count) {
+        scores.reset(new double[ordinal_count]);
+        stamps.resize(ordinal_count, 0);
+    }
+    if (++accumulator.stamp == 0) {
+        std::fill(stamps.begin(), stamps.end(), 0);
+        accumulator.stamp = 1;
+    }
+    const uint32_t stamp = accumulator.stamp;
+    auto& touched_ordinals = accumulator.touched_ordinals;
+    touched_ordinals.clear();
+    constexpr double EXCLUDED = -std::numeric_limits<double>::infinity();
+
+    // Documents with a minus word and, once met, documents of other statuses keep a score of minus infinity
+    for (const TermId term_id : query.minus_terms) {
+        for (Cursor cursor = OpenCursor<Cursor>(term_id, 0, ordinal_count); !cursor.IsEnd(); cursor.Next()) {
+            stamps[cursor.GetOrdinal()] = stamp;
+            scores[cursor.GetOrdinal()] = EXCLUDED;
+        }
+    }
+    const DocumentBitmap* status_documents = GetStatusDocuments(status);
+    const auto has_status = [&](DocumentOrdinal ordinal) {
+        return status_documents != nullptr ? status_documents->Test(ordinal) : documents_[ordinal].status == status;
+    };
+    // Score of the k-th best document among the ordinals, at most the final one of that document
+    auto& top_scores = accumulator.top_scores;
+    const auto get_kth_score = [&](const std::vector<DocumentOrdinal>& ordinals) {
+        top_scores.clear();
+        for (const DocumentOrdinal ordinal : ordinals) {
+            top_scores.push_back(scores[ordinal]);
+        }
+        std::nth_element(top_scores.begin(), top_scores.begin() + (max_result_count - 1), top_scores.end(), std::greater<>());
+        return top_scores[max_result_count - 1];
+    };
+
+    // Shortest posting lists first, remaining_bounds[i] is the best score the terms from i on can add together
+    auto& terms = accumulator.terms;
+    terms = query.plus_terms;
+    std::sort(terms.begin(), terms.end(), [this](const ScoredTerm& lhs, const ScoredTerm& rhs) {
+        return GetDocumentFreq(lhs.term_id) < GetDocumentFreq(rhs.term_id);
+    });
+    auto& remaining_bounds = accumulator.remaining_bounds;
+    remaining_bounds.assign(terms.size() + 1, 0.0);
+    for (size_t i = terms.size(); i-- > 0;) {
+        remaining_bounds[i] = remaining_bounds[i + 1] + terms[i].upper_bound;
+    }
+
+    size_t term_index = 0;
+    double threshold = -std::numeric_limits<double>::infinity();
+    for (; term_index < terms.size(); ++term_index) {
+        if (touched_ordinals.size() >= max_result_count) {
+            threshold = get_kth_score(touched_ordinals) - RELEVANCE_EPSILON;
+            if (remaining_bounds[term_index] <= threshold) {
+                break;
+            }
+        }
+        const ScoredTerm& term = terms[term_index];
+        for (Cursor cursor = OpenCursor<Cursor>(term.term_id, 0, ordinal_count); !cursor.IsEnd(); cursor.Next()) {
+            const DocumentOrdinal ordinal = cursor.GetOrdinal();
+            const double score = scorer.Score(term.weight, cursor.GetTermCount(), cursor.GetWordCount());
+            if (stamps[ordinal] != stamp) {
+                stamps[ordinal] = stamp;
+                if (has_status(ordinal)) {
+                    scores[ordinal] = score;
+                    touched_ordinals.push_back(ordinal);
+                } else {
+                    scores[ordinal] = EXCLUDED;
+                }
+            } else {
+                scores[ordinal] += score;
+            }
+        }
+    }
+
+    TopDocuments& top_documents = accumulator.top_documents;
+    top_documents.Reset(max_result_count);
+    if (term_index < terms.size()) {
+        touched_ordinals.erase(std::remove_if(touched_ordinals.begin(), touched_ordinals.end(), [&](DocumentOrdinal ordinal) {
+            return scores[ordinal] + remaining_bounds[term_index] <= threshold;
+        }), touched_ordinals.end());
+        // The accumulated documents are completed one by one in ordinal order, as the non-essential terms of
+        // EvaluateRange: a term is probed only while the bounds of the blocks that may hold the document leave
+        // it a chance, and every completed document raises the threshold
+        std::sort(touched_ordinals.begin(), touched_ordinals.end());
+        auto& buffers = std::get<CursorBuffers<Cursor>>(accumulator.cursor_storage);
+        auto& cursors = buffers.plus_cursors;
+        auto& block_bounds = buffers.block_bounds;
+        auto& block_bound_suffix = buffers.block_bound_prefix;
+        cursors.clear();
+        for (size_t i = term_index; i < terms.size(); ++i) {
+            cursors.push_back(OpenCursor<Cursor>(terms[i].term_id, 0, ordinal_count));
+        }
+        block_bounds.resize(cursors.size());
+        block_bound_suffix.resize(cursors.size() + 1);
+        for (const DocumentOrdinal ordinal : touched_ordinals) {
+            double relevance = scores[ordinal];
+            block_bound_suffix[cursors.size()] = 0.0;
+            for (size_t i = cursors.size(); i-- > 0;) {
+                const ScoredTerm& term = terms[term_index + i];
+                block_bounds[i] = std::min(term.upper_bound, scorer.GetUpperBound(term.weight, cursors[i].GetBound(ordinal)));
+                block_bound_suffix[i] = block_bound_suffix[i + 1] + block_bounds[i];
+            }
+            bool pruned = false;
+            for (size_t i = 0; i < cursors.size(); ++i) {
+                if (relevance + block_bound_suffix[i] <= threshold) {
+                    pruned = true;
+                    break;
+                }
+                if (block_bounds[i] == 0.0) {
+                    continue;
+                }
+                auto& cursor = cursors[i];
+                cursor.Advance(ordinal);
+                if (!cursor.IsEnd() && cursor.GetOrdinal() == ordinal) {
+                    relevance += scorer.Score(terms[term_index + i].weight, cursor.GetTermCount(), cursor.GetWordCount());
+                }
             }
-            const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-            for (const auto [document_id, term_freq] : word_to_document_freqs_.at(word)) {
-                const auto& document_data = documents_.at(document_id);
-                if (document_predicate(document_id, document_data.status, document_data.rating)) {
-                    document_to_relevance[document_id].ref_to_value += term_freq * inverse_document_freq;
+            if (pruned) {
+                continue;
+            }
+            const DocumentData& document_data = documents_[ordinal];
+            top_documents.Push({document_data.id, relevance, document_data.rating});
+            threshold = std::max(threshold, top_documents.GetAdmissionThreshold());
+        }
+        top_documents.ExtractSorted(result);
+        return;
+    }
+
+    for (const DocumentOrdinal ordinal : touched_ordinals) {
+        const DocumentData& document_data = documents_[ordinal];
+        top_documents.Push({document_data.id, scores[ordinal], document_data.rating});
+    }
+    top_documents.ExtractSorted(result);
+}
+
+// Document-at-a-time MaxScore evaluation. Terms are ordered by their score upper bound; once the top is
+// full, the cheapest terms whose bounds together cannot reach the admission threshold become non-essential:
+// their postings are only probed for candidates found in the essential ones, and only while the bounds of
+// the blocks holding the candidate leave it a chance. Excluded documents are dropped before they are scored,
+// with bit tests instead of a probe of every minus word
+template <typename Cursor, typename Scorer, typename DocumentPredicate>
+void SearchServer::EvaluateRange(const PreparedQuery& query, const Scorer& scorer, DocumentPredicate document_predicate,
+                                 DocumentOrdinal range_begin, DocumentOrdinal range_end,
+                                 TopDocuments& top_documents, std::atomic<double>* shared_threshold,
+                                 CursorBuffers<Cursor>& buffers) const {
+    const auto& terms = query.plus_terms;
+    const auto& bound_prefix = query.bound_prefix;
+    auto& cursors = buffers.plus_cursors;
+    auto& block_bounds = buffers.block_bounds;
+    auto& block_bound_prefix = buffers.block_bound_prefix;
+    cursors.clear();
+    for (const ScoredTerm& term : terms) {
+        cursors.push_back(OpenCursor<Cursor>(term.term_id, range_begin, range_end));
+    }
+    const DocumentBitmap* allowed_documents = query.allowed_documents;
+    const DocumentBitmap* removed_documents = query.removed_documents;
+    const DocumentBitmap* excluded_documents = query.has_excluded_documents ? &query.excluded_documents : nullptr;
+    // Known filters need no score, so they are checked before the candidate is scored. Other predicates may
+    // be costly and see only the candidates that can get into the top
+    constexpr bool is_known_filter = std::is_same_v<DocumentPredicate, StatusFilter> || std::is_same_v<DocumentPredicate, RatingAtLeast>
+                                     || std::is_same_v<DocumentPredicate, DocumentIdRange>;
+    constexpr bool is_generic_predicate = !is_known_filter && !std::is_same_v<DocumentPredicate, NoFilter>;
+    const auto is_excluded = [&](DocumentOrdinal ordinal) {
+        if ((allowed_documents != nullptr && !allowed_documents->Test(ordinal))
+            || (removed_documents != nullptr && removed_documents->Test(ordinal))
+            || (excluded_documents != nullptr && excluded_documents->Test(ordinal))) {
+            return true;
+        }
+        if constexpr (is_known_filter) {
+            const auto& document_data = documents_[ordinal];
+            return !document_predicate(document_data.id, document_data.status, document_data.rating);
+        } else {
+            return false;
+        }
+    };
+
+    size_t first_essential = 0;
+    double threshold = top_documents.GetAdmissionThreshold();
+    const auto update_threshold = [&]() {
+        threshold = top_documents.GetAdmissionThreshold();
+        if (shared_threshold != nullptr) {
+            double published = shared_threshold->load(std::memory_order_relaxed);
+            while (published < threshold
+                   && !shared_threshold->compare_exchange_weak(published, threshold, std::memory_order_relaxed)) {
+            }
+            threshold = std::max(threshold, published);
+        }
+        while (first_essential < terms.size() && bound_prefix[first_essential + 1] <= threshold) {
+            ++first_essential;
+        }
+    };
+    update_threshold();
+    // Local counts, the metrics get them once the range is done
+    uint64_t scanned_posting_count = 0;
+    uint64_t scored_document_count = 0;
+
+    while (first_essential < terms.size()) {
+        DocumentOrdinal candidate = std::numeric_limits<DocumentOrdinal>::max();
+        bool has_candidate = false;
+        for (size_t i = first_essential; i < terms.size(); ++i) {
+            if (!cursors[i].IsEnd() && (!has_candidate || cursors[i].GetOrdinal() < candidate)) {
+                candidate = cursors[i].GetOrdinal();
+                has_candidate = true;
+            }
+        }
+        if (!has_candidate) {
+            break;
+        }
+        if (is_excluded(candidate)) {
+            for (size_t i = first_essential; i < terms.size(); ++i) {
+                if (!cursors[i].IsEnd() && cursors[i].GetOrdinal() == candidate) {
+                    cursors[i].Next();
+                    ++scanned_posting_count;
                 }
             }
+            continue;
         }
-    );
 
-    for_each(
-        std::execution::par,
-        query.minus_words.begin(), query.minus_words.end(),
-        [this, &document_to_relevance](std::string_view word) {
-            if (word_to_document_freqs_.count(word) == 0) {
-                return;
+        double relevance = 0.0;
+        ++scored_document_count;
+        for (size_t i = first_essential; i < terms.size(); ++i) {
+            auto& cursor = cursors[i];
+            if (!cursor.IsEnd() && cursor.GetOrdinal() == candidate) {
+                relevance += scorer.Score(terms[i].weight, cursor.GetTermCount(), cursor.GetWordCount());
+                cursor.Next();
+                ++scanned_posting_count;
             }
-            for (const auto [document_id, _] : word_to_document_freqs_.at(word)) {
-                document_to_relevance.erase(document_id);
+        }
+        if (relevance + bound_prefix[first_essential] <= threshold) {
+            continue;
+        }
+
+        const auto& document_data = documents_[candidate];
+        if constexpr (is_generic_predicate) {
+            if (!document_predicate(document_data.id, document_data.status, document_data.rating)) {
+                continue;
             }
         }
-    );
 
-    std::vector<Document> matched_documents;
-    for (const auto [document_id, relevance] : document_to_relevance.BuildOrdinaryMap()) {
-        matched_documents.push_back({document_id, relevance, documents_.at(document_id).rating});
+        // Blocks of the non-essential terms that may hold the candidate, their bounds are at most the list ones
+        block_bounds.resize(first_essential);
+        block_bound_prefix.assign(first_essential + 1, 0.0);
+        for (size_t i = 0; i < first_essential; ++i) {
+            block_bounds[i] = std::min(terms[i].upper_bound, scorer.GetUpperBound(terms[i].weight, cursors[i].GetBound(candidate)));
+            block_bound_prefix[i + 1] = block_bound_prefix[i] + block_bounds[i];
+        }
+        bool pruned = false;
+        for (size_t i = first_essential; i-- > 0;) {
+            if (relevance + block_bound_prefix[i + 1] <= threshold) {
+                pruned = true;
+                break;
+            }
+            if (block_bounds[i] == 0.0) {
+                continue;
+            }
+            auto& cursor = cursors[i];
+            cursor.Advance(candidate);
+            ++scanned_posting_count;
+            if (!cursor.IsEnd() && cursor.GetOrdinal() == candidate) {
+                relevance += scorer.Score(terms[i].weight, cursor.GetTermCount(), cursor.GetWordCount());
+            }
+        }
+        if (pruned) {
+            continue;
+        }
+
+        top_documents.Push({document_data.id, relevance, document_data.rating});
+        update_threshold();
+    }
+    if (metrics_ != nullptr) {
+        metrics_->AddTraversalCounts(scanned_posting_count, scored_document_count);
     }
-    return matched_documents;
 }
\ No newline at end of file
@@ -0,0 +1,533 @@
+#include "sharded_search_server.h"
+
+#include "thread_pool.h"
+#include "top_documents.h"
+
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+
+enum class ShardRequest : uint8_t {
+    ADD_DOCUMENT,
+    REMOVE_DOCUMENT,
+    COLLECT_STATISTICS,
+    FIND_TOP_DOCUMENTS,
+    MATCH_DOCUMENT,
+    GET_DOCUMENT_COUNT,
+};
+
+// The first byte of a response, the message of the error follows it
+enum class ShardResponse : uint8_t {
+    OK,
+    INVALID_ARGUMENT,
+    OUT_OF_RANGE,
+    OTHER_ERROR,
+};
+
+// Numbers are written little-endian with a fixed width, so nodes of any platform read each other's messages
+class MessageWriter {
+public:
+    void PutUint(uint64_t value) {
+        for (int byte = 0; byte < 8; ++byte) {
+            message_.push_back(static_cast<char>(value >> (8 * byte) & 0xFF));
+        }
+    }
+
+    void PutInt(int64_t value) {
+        PutUint(static_cast<uint64_t>(value));
+    }
+
+    void PutDouble(double value) {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        PutUint(bits);
+    }
+
+    void PutByte(uint8_t value) {
+        message_.push_back(static_cast<char>(value));
+    }
+
+    void PutString(string_view value) {
+        PutUint(value.size());
+        message_.append(value);
+    }
+
+    string Release() {
+        return move(message_);
+    }
+
+private:
+    string message_;
+};
+
+class MessageReader {
+public:
+    explicit MessageReader(const string& message)
+        : message_(message) {
+    }
+
+    uint64_t GetUint() {
+        const string_view bytes = Take(8);
+        uint64_t value = 0;
+        for (int byte = 0; byte < 8; ++byte) {
+            value |= uint64_t{static_cast<unsigned char>(bytes[byte])} << (8 * byte);
+        }
+        return value;
+    }
+
+    int64_t GetInt() {
+        return static_cast<int64_t>(GetUint());
+    }
+
+    double GetDouble() {
+        const uint64_t bits = GetUint();
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    uint8_t GetByte() {
+        return static_cast<uint8_t>(Take(1)[0]);
+    }
+
+    string_view GetString() {
+        return Take(GetUint());
+    }
+
+    // A count of items taking at least min_item_size bytes each, checked against the rest of the message
+    size_t GetCount(size_t min_item_size) {
+        const uint64_t count = GetUint();
+        if (count > (message_.size() - position_) / min_item_size) {
+            throw invalid_argument("Malformed shard message"s);
+        }
+        return count;
+    }
+
+    void ExpectEnd() const {
+        if (position_ != message_.size()) {
+            throw invalid_argument("Malformed shard message"s);
+        }
+    }
+
+private:
+    string_view message_;
+    size_t position_ = 0;
+
+    string_view Take(uint64_t size) {
+        if (size > message_.size() - position_) {
+            throw invalid_argument("Malformed shard message"s);
+        }
+        const string_view bytes = message_.substr(position_, size);
+        position_ += size;
+        return bytes;
+    }
+};
+
+DocumentStatus GetStatus(MessageReader& reader) {
+    const uint8_t status = reader.GetByte();
+    if (status > static_cast<uint8_t>(DocumentStatus::REMOVED)) {
+        throw invalid_argument("Malformed shard message"s);
+    }
+    return static_cast<DocumentStatus>(status);
+}
+
+void PutStatistics(MessageWriter& writer, const CollectionStatistics& statistics) {
+    writer.PutInt(statistics.document_count);
+    writer.PutUint(statistics.word_count);
+    writer.PutUint(statistics.document_freqs.size());
+    for (const auto& [word, freq] : statistics.document_freqs) {
+        writer.PutString(word);
+        writer.PutInt(freq);
+    }
+}
+
+CollectionStatistics GetStatistics(MessageReader& reader) {
+    CollectionStatistics statistics;
+    statistics.document_count = static_cast<int>(reader.GetInt());
+    statistics.word_count = reader.GetUint();
+    for (size_t i = reader.GetCount(16); i > 0; --i) {
+        const string_view word = reader.GetString();
+        statistics.document_freqs.emplace(string(word), static_cast<int>(reader.GetInt()));
+    }
+    return statistics;
+}
+
+void AddStatistics(CollectionStatistics& statistics, const CollectionStatistics& other) {
+    statistics.document_count += other.document_count;
+    statistics.word_count += other.word_count;
+    for (const auto& [word, freq] : other.document_freqs) {
+        statistics.document_freqs[word] += freq;
+    }
+}
+
+// Runs the request and returns the response without its first byte
+string ServeRequest(SearchShard& shard, MessageReader& reader) {
+    MessageWriter writer;
+    switch (static_cast<ShardRequest>(reader.GetByte())) {
+        case ShardRequest::ADD_DOCUMENT: {
+            const int document_id = static_cast<int>(reader.GetInt());
+            const string_view document = reader.GetString();
+            const DocumentStatus status = GetStatus(reader);
+            vector<int> ratings(reader.GetCount(8));
+            for (int& rating : ratings) {
+                rating = static_cast<int>(reader.GetInt());
+            }
+            reader.ExpectEnd();
+            shard.AddDocument(document_id, document, status, ratings);
+            break;
+        }
+        case ShardRequest::REMOVE_DOCUMENT: {
+            const int document_id = static_cast<int>(reader.GetInt());
+            reader.ExpectEnd();
+            shard.RemoveDocument(document_id);
+            break;
+        }
+        case ShardRequest::COLLECT_STATISTICS: {
+            const string_view raw_query = reader.GetString();
+            reader.ExpectEnd();
+            CollectionStatistics statistics;
+            shard.CollectStatistics(raw_query, statistics);
+            PutStatistics(writer, statistics);
+            break;
+        }
+        case ShardRequest::FIND_TOP_DOCUMENTS: {
+            const CollectionStatistics statistics = GetStatistics(reader);
+            const string_view raw_query = reader.GetString();
+            const DocumentStatus status = GetStatus(reader);
+            const uint64_t max_result_count = reader.GetUint();
+            reader.ExpectEnd();
+            const vector<Document> documents = shard.FindTopDocuments(statistics, raw_query, status, max_result_count);
+            writer.PutUint(documents.size());
+            for (const Document& document : documents) {
+                writer.PutInt(document.id);
+                writer.PutDouble(document.relevance);
+                writer.PutInt(document.rating);
+            }
+            break;
+        }
+        case ShardRequest::MATCH_DOCUMENT: {
+            const string_view raw_query = reader.GetString();
+            const int document_id = static_cast<int>(reader.GetInt());
+            reader.ExpectEnd();
+            const auto [words, status] = shard.MatchDocument(raw_query, document_id);
+            writer.PutUint(words.size());
+            for (const string& word : words) {
+                writer.PutString(word);
+            }
+            writer.PutByte(static_cast<uint8_t>(status));
+            break;
+        }
+        case ShardRequest::GET_DOCUMENT_COUNT:
+            reader.ExpectEnd();
+            writer.PutInt(shard.GetDocumentCount());
+            break;
+        default:
+            throw invalid_argument("Malformed shard message"s);
+    }
+    return writer.Release();
+}
+
+}  // namespace
+
+LocalSearchShard::LocalSearchShard(string_view stop_words_text)
+    : search_server_(stop_words_text) {
+}
+
+LocalSearchShard::LocalSearchShard(SearchServer search_server)
+    : search_server_(move(search_server)) {
+}
+
+void LocalSearchShard::AddDocument(int document_id, string_view document, DocumentStatus status, const vector<int>& ratings) {
+    search_server_.AddDocument(document_id, document, status, ratings);
+}
+
+void LocalSearchShard::RemoveDocument(int document_id) {
+    search_server_.RemoveDocument(document_id);
+}
+
+void LocalSearchShard::CollectStatistics(string_view raw_query, CollectionStatistics& statistics) const {
+    search_server_.CollectStatistics(raw_query, statistics);
+}
+
+vector<Document> LocalSearchShard::FindTopDocuments(const CollectionStatistics& statistics, string_view raw_query,
+                                                    DocumentStatus status, size_t max_result_count) const {
+    return search_server_.FindTopDocuments(statistics, nullptr, raw_query, StatusFilter{status}, max_result_count);
+}
+
+SearchShard::MatchDocumentResult LocalSearchShard::MatchDocument(string_view raw_query, int document_id) const {
+    const auto [words, status] = search_server_.MatchDocument(raw_query, document_id);
+    return {vector<string>(words.begin(), words.end()), status};
+}
+
+int LocalSearchShard::GetDocumentCount() const {
+    return search_server_.GetDocumentCount();
+}
+
+const SearchServer& LocalSearchShard::GetSearchServer() const {
+    return search_server_;
+}
+
+string ServeShardRequest(SearchShard& shard, const string& request) {
+    MessageReader reader(request);
+    ShardResponse response = ShardResponse::OK;
+    string payload;
+    try {
+        payload = ServeRequest(shard, reader);
+    } catch (const invalid_argument& error) {
+        response = ShardResponse::INVALID_ARGUMENT;
+        payload = error.what();
+    } catch (const out_of_range& error) {
+        response = ShardResponse::OUT_OF_RANGE;
+        payload = error.what();
+    } catch (const exception& error) {
+        response = ShardResponse::OTHER_ERROR;
+        payload = error.what();
+    }
+    MessageWriter writer;
+    writer.PutByte(static_cast<uint8_t>(response));
+    string result = writer.Release();
+    result += payload;
+    return result;
+}
+
+namespace {
+
+// Sends the request and returns a reader of the payload of a successful response, response keeps its bytes
+MessageReader Call(const ShardTransport& transport, MessageWriter& request, string& response) {
+    response = transport(request.Release());
+    if (response.empty()) {
+        throw runtime_error("Empty shard response"s);
+    }
+    switch (static_cast<ShardResponse>(response[0])) {
+        case ShardResponse::OK:
+            break;
+        case ShardResponse::INVALID_ARGUMENT:
+            throw invalid_argument(response.substr(1));
+        case ShardResponse::OUT_OF_RANGE:
+            throw out_of_range(response.substr(1));
+        default:
+            throw runtime_error(response.substr(1));
+    }
+    MessageReader reader(response);
+    reader.GetByte();
+    return reader;
+}
+
+}  // namespace
+
+RemoteSearchShard::RemoteSearchShard(ShardTransport transport)
+    : transport_(move(transport)) {
+}
+
+void RemoteSearchShard::AddDocument(int document_id, string_view document, DocumentStatus status, const vector<int>& ratings) {
+    MessageWriter request;
+    request.PutByte(static_cast<uint8_t>(ShardRequest::ADD_DOCUMENT));
+    request.PutInt(document_id);
+    request.PutString(document);
+    request.PutByte(static_cast<uint8_t>(status));
+    request.PutUint(ratings.size());
+    for (const int rating : ratings) {
+        request.PutInt(rating);
+    }
+    string response;
+    Call(transport_, request, response).ExpectEnd();
+}
+
+void RemoteSearchShard::RemoveDocument(int document_id) {
+    MessageWriter request;
+    request.PutByte(static_cast<uint8_t>(ShardRequest::REMOVE_DOCUMENT));
+    request.PutInt(document_id);
+    string response;
+    Call(transport_, request, response).ExpectEnd();
+}
+
+void RemoteSearchShard::CollectStatistics(string_view raw_query, CollectionStatistics& statistics) const {
+    MessageWriter request;
+    request.PutByte(static_cast<uint8_t>(ShardRequest::COLLECT_STATISTICS));
+    request.PutString(raw_query);
+    string response;
+    MessageReader reader = Call(transport_, request, response);
+    AddStatistics(statistics, GetStatistics(reader));
+    reader.ExpectEnd();
+}
+
+vector<Document> RemoteSearchShard::FindTopDocuments(const CollectionStatistics& statistics, string_view raw_query,
+                                                     DocumentStatus status, size_t max_result_count) const {
+    MessageWriter request;
+    request.PutByte(static_cast<uint8_t>(ShardRequest::FIND_TOP_DOCUMENTS));
+    PutStatistics(request, statistics);
+    request.PutString(raw_query);
+    request.PutByte(static_cast<uint8_t>(status));
+    request.PutUint(max_result_count);
+    string response;
+    MessageReader reader = Call(transport_, request, response);
+    vector<Document> documents(reader.GetCount(24));
+    for (Document& document : documents) {
+        document.id = static_cast<int>(reader.GetInt());
+        document.relevance = reader.GetDouble();
+        document.rating = static_cast<int>(reader.GetInt());
+    }
+    reader.ExpectEnd();
+    return documents;
+}
+
+SearchShard::MatchDocumentResult RemoteSearchShard::MatchDocument(string_view raw_query, int document_id) const {
+    MessageWriter request;
+    request.PutByte(static_cast<uint8_t>(ShardRequest::MATCH_DOCUMENT));
+    request.PutString(raw_query);
+    request.PutInt(document_id);
+    string response;
+    MessageReader reader = Call(transport_, request, response);
+    vector<string> words(reader.GetCount(8));
+    for (string& word : words) {
+        word = reader.GetString();
+    }
+    const DocumentStatus status = GetStatus(reader);
+    reader.ExpectEnd();
+    return {move(words), status};
+}
+
+int RemoteSearchShard::GetDocumentCount() const {
+    MessageWriter request;
+    request.PutByte(static_cast<uint8_t>(ShardRequest::GET_DOCUMENT_COUNT));
+    string response;
+    MessageReader reader = Call(transport_, request, response);
+    const int document_count = static_cast<int>(reader.GetInt());
+    reader.ExpectEnd();
+    return document_count;
+}
+
+ShardedSearchServer::ShardedSearchServer(string_view stop_words_text, size_t shard_count) {
+    if (shard_count == 0) {
+        throw invalid_argument("Sharded server needs a shard"s);
+    }
+    for (size_t i = 0; i < shard_count; ++i) {
+        shards_.push_back(make_unique<LocalSearchShard>(stop_words_text));
+    }
+    InitShards();
+}
+
+ShardedSearchServer::ShardedSearchServer(vector<unique_ptr<SearchShard>> shards)
+    : shards_(move(shards)) {
+    if (shards_.empty()) {
+        throw invalid_argument("Sharded server needs a shard"s);
+    }
+    InitShards();
+}
+
+// Shards of other types may wait on a network, so only LocalSearchShard runs on the CPU pool
+void ShardedSearchServer::InitShards() {
+    for (size_t shard = 0; shard < shards_.size(); ++shard) {
+        if (dynamic_cast<const LocalSearchShard*>(shards_[shard].get()) != nullptr) {
+            local_shards_.push_back(shard);
+        } else {
+            remote_shards_.push_back(shard);
+        }
+    }
+    if (!remote_shards_.empty()) {
+        // The calling thread waits for the remote shards instead of running one
+        transport_pool_ = make_unique<ThreadPool>(remote_shards_.size() + 1);
+    }
+}
+
+void ShardedSearchServer::AddDocument(int document_id, string_view document, DocumentStatus status, const vector<int>& ratings) {
+    shards_[GetShardIndex(document_id)]->AddDocument(document_id, document, status, ratings);
+}
+
+void ShardedSearchServer::RemoveDocument(int document_id) {
+    shards_[GetShardIndex(document_id)]->RemoveDocument(document_id);
+}
+
+vector<Document> ShardedSearchServer::FindTopDocuments(string_view raw_query, DocumentStatus status, size_t max_result_count) const {
+    vector<CollectionStatistics> shard_statistics(shards_.size());
+    ForEachShard([&](size_t shard) {
+        shards_[shard]->CollectStatistics(raw_query, shard_statistics[shard]);
+    });
+    CollectionStatistics statistics;
+    for (const CollectionStatistics& other : shard_statistics) {
+        AddStatistics(statistics, other);
+    }
+
+    vector<vector<Document>> shard_documents(shards_.size());
+    ForEachShard([&](size_t shard) {
+        shard_documents[shard] = shards_[shard]->FindTopDocuments(statistics, raw_query, status, max_result_count);
+    });
+    TopDocuments top_documents(max_result_count);
+    for (const vector<Document>& documents : shard_documents) {
+        for (const Document& document : documents) {
+            top_documents.Push(document);
+        }
+    }
+    return top_documents.ExtractSorted();
+}
+
+SearchShard::MatchDocumentResult ShardedSearchServer::MatchDocument(string_view raw_query, int document_id) const {
+    return shards_[GetShardIndex(document_id)]->MatchDocument(raw_query, document_id);
+}
+
+int ShardedSearchServer::GetDocumentCount() const {
+    int document_count = 0;
+    for (const auto& shard : shards_) {
+        document_count += shard->GetDocumentCount();
+    }
+    return document_count;
+}
+
+size_t ShardedSearchServer::GetShardCount() const {
+    return shards_.size();
+}
+
+// The finalizer of MurmurHash3, sequential ids spread evenly over the shards
+size_t ShardedSearchServer::GetShardIndex(int document_id) const {
+    uint32_t hash = static_cast<uint32_t>(document_id);
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+    return hash % shards_.size();
+}
+
+void ShardedSearchServer::SetThreadPool(ThreadPool* thread_pool) {
+    thread_pool_ = thread_pool;
+}
+
+ThreadPool& ShardedSearchServer::GetThreadPool() const {
+    return thread_pool_ != nullptr ? *thread_pool_ : ThreadPool::GetDefault();
+}
+
+// The remote calls refer to the locals of the caller, so they are waited for even when a local shard fails
+void ShardedSearchServer::ForEachShard(const function<void(size_t)>& call) const {
+    vector<future<void>> remote_calls;
+    remote_calls.reserve(remote_shards_.size());
+    for (const size_t shard : remote_shards_) {
+        remote_calls.push_back(transport_pool_->Submit([&call, shard]() {
+            call(shard);
+        }));
+    }
+    exception_ptr exception;
+    try {
+        GetThreadPool().ParallelFor(local_shards_.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                call(local_shards_[i]);
+            }
+        });
+    } catch (...) {
+        exception = current_exception();
+    }
+    for (future<void>& remote_call : remote_calls) {
+        try {
+            remote_call.get();
+        } catch (...) {
+            if (!exception) {
+                exception = current_exception();
+            }
+        }
+    }
+    if (exception) {
+        rethrow_exception(exception);
+    }
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "search_server.h"
+#include "thread_pool.h"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+// One part of a sharded collection. Shards are driven by ShardedSearchServer and take only what fits into a
+// message: queries are filtered by status and matched words are copied. Const calls may run concurrently
+class SearchShard {
+public:
+    using MatchDocumentResult = std::tuple<std::vector<std::string>, DocumentStatus>;
+
+    virtual ~SearchShard() = default;
+
+    virtual void AddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings) = 0;
+    virtual void RemoveDocument(int document_id) = 0;
+
+    // Adds the statistics of the shard, see SearchServer::CollectStatistics
+    virtual void CollectStatistics(std::string_view raw_query, CollectionStatistics& statistics) const = 0;
+    // Top documents of the shard scored with collection-wide statistics
+    virtual std::vector<Document> FindTopDocuments(const CollectionStatistics& statistics, std::string_view raw_query,
+                                                   DocumentStatus status, size_t max_result_count) const = 0;
+    virtual MatchDocumentResult MatchDocument(std::string_view raw_query, int document_id) const = 0;
+    virtual int GetDocumentCount() const = 0;
+};
+
+// Shard held in this process
+class LocalSearchShard : public SearchShard {
+public:
+    explicit LocalSearchShard(std::string_view stop_words_text);
+    explicit LocalSearchShard(SearchServer search_server);
+
+    void AddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings) override;
+    void RemoveDocument(int document_id) override;
+    void CollectStatistics(std::string_view raw_query, CollectionStatistics& statistics) const override;
+    std::vector<Document> FindTopDocuments(const CollectionStatistics& statistics, std::string_view raw_query,
+                                           DocumentStatus status, size_t max_result_count) const override;
+    MatchDocumentResult MatchDocument(std::string_view raw_query, int document_id) const override;
+    int GetDocumentCount() const override;
+
+    const SearchServer& GetSearchServer() const;
+
+private:
+    SearchServer search_server_;
+};
+
+// Sends one encoded request to the node of a shard and returns the encoded response, e.g. by
+// passing both to ServeShardRequest on that node. Failures to deliver are reported by throwing
+using ShardTransport = std::function<std::string(const std::string& request)>;
+
+// Shard on another node. Every call is one request through the transport; errors of the remote shard are
+// rethrown as std::invalid_argument, std::out_of_range or std::runtime_error
+class RemoteSearchShard : public SearchShard {
+public:
+    explicit RemoteSearchShard(ShardTransport transport);
+
+    void AddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings) override;
+    void RemoveDocument(int document_id) override;
+    void CollectStatistics(std::string_view raw_query, CollectionStatistics& statistics) const override;
+    std::vector<Document> FindTopDocuments(const CollectionStatistics& statistics, std::string_view raw_query,
+                                           DocumentStatus status, size_t max_result_count) const override;
+    MatchDocumentResult MatchDocument(std::string_view raw_query, int document_id) const override;
+    int GetDocumentCount() const override;
+
+private:
+    ShardTransport transport_;
+};
+
+// Decodes a request of RemoteSearchShard, runs it on the shard and encodes the response.
+// Errors of the shard are encoded into the response, malformed requests throw std::invalid_argument
+std::string ServeShardRequest(SearchShard& shard, const std::string& request);
+
+// Collection split between shards by a hash of the document id. Queries are scattered to all shards and
+// their tops are merged; the shards score with document frequencies summed over the whole collection,
+// so results match a single SearchServer holding all documents. Local shards are searched on the thread pool,
+// the others block on their transport and get a thread each, so round trips overlap the local searches.
+// Writes must not overlap other calls
+class ShardedSearchServer {
+public:
+    // shard_count local shards
+    ShardedSearchServer(std::string_view stop_words_text, size_t shard_count);
+    // Throws std::invalid_argument if there are no shards
+    explicit ShardedSearchServer(std::vector<std::unique_ptr<SearchShard>> shards);
+
+    void AddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
+    void RemoveDocument(int document_id);
+
+    // Two rounds over the shards: one collects the statistics of the query words, one searches
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status = DocumentStatus::ACTUAL,
+                                           size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    // Throws std::out_of_range for unknown documents
+    SearchShard::MatchDocumentResult MatchDocument(std::string_view raw_query, int document_id) const;
+    int GetDocumentCount() const;
+
+    size_t GetShardCount() const;
+    // The hash does not depend on the platform, so every node routes an id to the same shard
+    size_t GetShardIndex(int document_id) const;
+
+    // Local shards are searched on the pool, null selects ThreadPool::GetDefault(). The pool is not owned
+    void SetThreadPool(ThreadPool* thread_pool);
+    ThreadPool& GetThreadPool() const;
+
+private:
+    std::vector<std::unique_ptr<SearchShard>> shards_;
+    std::vector<size_t> local_shards_;
+    std::vector<size_t> remote_shards_;
+    ThreadPool* thread_pool_ = nullptr;
+    std::unique_ptr<ThreadPool> transport_pool_;  // A worker per remote shard, null without them
+
+    void InitShards();
+    // Calls call(shard) for every shard and waits for all of them before rethrowing the first error
+    void ForEachShard(const std::function<void(size_t)>& call) const;
+};
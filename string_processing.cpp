@@ -4,14 +4,8 @@ using namespace std;
 
 vector<string_view> SplitIntoWords(string_view str) {
     vector<string_view> result;
-    while (true) {
-        const auto space = str.find(' ');
-        result.push_back(str.substr(0, space));
-        if (space == str.npos) {
-            break;
-        } else {
-            str.remove_prefix(space + 1);
-        }
-    }
+    ForEachWord(str, [&result](string_view word, bool) {
+        result.push_back(word);
+    });
     return result;
-}
\ No newline at end of file
+}
@@ -1,9 +1,20 @@
 #pragma once
+#include <cstdint>
 #include <set>
 #include <string>
 #include <string_view>
 #include <vector>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Calls function(word, is_valid) for every part of text between single spaces, empty parts included.
+// A word is valid if it contains no control characters (codes 0-31). Separators and control characters
+// are located in a single pass over the text, sixteen bytes at a time with SSE2
+template <typename Function>
+void ForEachWord(std::string_view text, Function function);
+
 std::vector<std::string_view> SplitIntoWords(std::string_view text);
 
 using TransparentStringSet = std::set<std::string, std::less<>>;
@@ -17,4 +28,82 @@ TransparentStringSet MakeUniqueNonEmptyStrings(const StringContainer& strings) {
         }
     }
     return non_empty_strings;
-}
\ No newline at end of file
+}
+
+namespace string_processing_detail {
+
+const size_t SCAN_BLOCK_SIZE = 16;
+
+inline bool IsControl(char c) {
+    return static_cast<unsigned char>(c) < ' ';
+}
+
+// Index of the lowest set bit, value must not be zero
+inline unsigned CountTrailingZeros(uint32_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctz(value);
+#else
+    unsigned count = 0;
+    for (; (value & 1) == 0; value >>= 1) {
+        ++count;
+    }
+    return count;
+#endif
+}
+
+// Bit i of spaces / controls is set if byte i of the block is a space / a control character
+inline void ScanBlock(const char* data, uint32_t& spaces, uint32_t& controls) {
+#if defined(__SSE2__)
+    const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+    spaces = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')));
+    // Unsigned bytes <= 31 are the ones not changed by min(byte, 31)
+    const __m128i max_control = _mm_set1_epi8(' ' - 1);
+    controls = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(bytes, max_control), bytes));
+#else
+    spaces = 0;
+    controls = 0;
+    for (size_t i = 0; i < SCAN_BLOCK_SIZE; ++i) {
+        spaces |= uint32_t{data[i] == ' '} << i;
+        controls |= uint32_t{IsControl(data[i])} << i;
+    }
+#endif
+}
+
+}  // namespace string_processing_detail
+
+template <typename Function>
+void ForEachWord(std::string_view text, Function function) {
+    using namespace string_processing_detail;
+    const char* const data = text.data();
+    const size_t size = text.size();
+    size_t word_begin = 0;
+    bool is_valid = true;
+
+    size_t position = 0;
+    for (; position + SCAN_BLOCK_SIZE <= size; position += SCAN_BLOCK_SIZE) {
+        uint32_t spaces;
+        uint32_t controls;
+        ScanBlock(data + position, spaces, controls);
+        // Control characters are rare: once the current word is invalid they only matter at the next space
+        for (uint32_t events = spaces | controls; events != 0; events &= events - 1) {
+            const unsigned offset = CountTrailingZeros(events);
+            if ((spaces >> offset) & 1) {
+                function(std::string_view(data + word_begin, position + offset - word_begin), is_valid);
+                word_begin = position + offset + 1;
+                is_valid = true;
+            } else {
+                is_valid = false;
+            }
+        }
+    }
+    for (; position < size; ++position) {
+        if (data[position] == ' ') {
+            function(std::string_view(data + word_begin, position - word_begin), is_valid);
+            word_begin = position + 1;
+            is_valid = true;
+        } else if (IsControl(data[position])) {
+            is_valid = false;
+        }
+    }
+    function(std::string_view(data + word_begin, size - word_begin), is_valid);
+}
@@ -0,0 +1,54 @@
+#include "term_dictionary.h"
+
+using namespace std;
+
+TermDictionary::TermDictionary(const TermDictionary& other)
+    : term_chars_(other.term_chars_)
+    , terms_(other.terms_) {
+    RebuildTermIds();
+}
+
+TermDictionary& TermDictionary::operator=(const TermDictionary& other) {
+    if (this != &other) {
+        term_chars_ = other.term_chars_;
+        terms_ = other.terms_;
+        RebuildTermIds();
+    }
+    return *this;
+}
+
+pair<TermId, bool> TermDictionary::Intern(string_view term) {
+    const auto it = term_ids_.find(term);
+    if (it != term_ids_.end()) {
+        return {it->second, false};
+    }
+    const TermId term_id = terms_.size();
+    terms_.push_back(term_chars_.Add(term.data(), term.size()));
+    term_ids_.emplace((*this)[term_id], term_id);
+    return {term_id, true};
+}
+
+optional<TermId> TermDictionary::Find(string_view term) const {
+    const auto it = term_ids_.find(term);
+    if (it == term_ids_.end()) {
+        return nullopt;
+    }
+    return it->second;
+}
+
+void TermDictionary::reserve(size_t term_count) {
+    terms_.reserve(term_count);
+    term_ids_.reserve(term_count);
+}
+
+size_t TermDictionary::size() const {
+    return terms_.size();
+}
+
+void TermDictionary::RebuildTermIds() {
+    term_ids_.clear();
+    term_ids_.reserve(terms_.size());
+    for (TermId term_id = 0; term_id < terms_.size(); ++term_id) {
+        term_ids_.emplace((*this)[term_id], term_id);
+    }
+}
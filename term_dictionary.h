@@ -0,0 +1,43 @@
+#pragma once
+
+#include "arena.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Dense number of a distinct term, assigned in the order terms are first seen
+using TermId = uint32_t;
+
+// Stores every distinct term once, packed into an arena. Views of the terms stay valid for the lifetime
+// of the dictionary, copies rebuild their lookup table so it never points into another dictionary
+class TermDictionary {
+public:
+    TermDictionary() = default;
+    TermDictionary(const TermDictionary& other);
+    TermDictionary(TermDictionary&& other) = default;
+    TermDictionary& operator=(const TermDictionary& other);
+    TermDictionary& operator=(TermDictionary&& other) = default;
+
+    // Returns the id of the term and whether it has just been added
+    std::pair<TermId, bool> Intern(std::string_view term);
+    std::optional<TermId> Find(std::string_view term) const;
+
+    std::string_view operator[](TermId term_id) const {
+        return {term_chars_.GetData(terms_[term_id]), terms_[term_id].size};
+    }
+
+    void reserve(size_t term_count);
+    size_t size() const;
+
+private:
+    Arena<char> term_chars_;
+    std::vector<Arena<char>::Ref> terms_;  // Indexed by TermId
+    std::unordered_map<std::string_view, TermId> term_ids_;  // Keys point into term_chars_
+
+    void RebuildTermIds();
+};
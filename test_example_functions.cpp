@@ -49,9 +49,11 @@ void MatchDocuments(const SearchServer& search_server, string_view query) {
     try {
         cout << "Матчинг документов по запросу: "s << query << endl;
         
-        for (int document_id : search_server) {
-            const auto [words, status] = search_server.MatchDocument(query, document_id);
-            PrintMatchDocumentResult(document_id, words, status);
+        const vector<int> document_ids(search_server.begin(), search_server.end());
+        const auto results = search_server.MatchDocuments(query, document_ids);
+        for (size_t i = 0; i < document_ids.size(); ++i) {
+            const auto& [words, status] = results[i];
+            PrintMatchDocumentResult(document_ids[i], words, status);
         }
     } catch (const invalid_argument& e) {
         cout << "Ошибка матчинга документов на запрос "s << query << ": "s << e.what() << endl;
@@ -59,27 +61,7 @@ void MatchDocuments(const SearchServer& search_server, string_view query) {
 }
 
 void RemoveDuplicates(SearchServer& search_server) {
-    std::set<std::set<std::string_view>> existing_docs;
-    std::vector<int> found_duplicates;
-
-    for (int document_id : search_server) {
-        auto& freqs = search_server.GetWordFrequencies(document_id);
-        std::set<std::string_view> words;
-
-        std::transform(freqs.begin(), freqs.end(), std::inserter(words, words.begin()), 
-        [](auto p) {
-            return p.first;
-        });
-
-        if (existing_docs.count(words) > 0) {
-            cout << "Found duplicate document id " << document_id << endl;
-            found_duplicates.push_back(document_id);
-        } else {
-            existing_docs.insert(words);
-        }
-    }
-
-    for (int id : found_duplicates) {
-        search_server.RemoveDocument(id);
+    for (const int document_id : search_server.RemoveDuplicates(execution::par)) {
+        cout << "Found duplicate document id " << document_id << endl;
     }
 }
\ No newline at end of file
@@ -0,0 +1,298 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <string>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+// Set in the pool threads, so loops started from a chunk run sequentially instead of waiting for themselves
+thread_local bool is_pool_thread = false;
+
+uint64_t PackChunks(uint64_t begin, uint64_t end) {
+    return begin << 32 | end;
+}
+
+uint64_t GetBegin(uint64_t chunks) {
+    return chunks >> 32;
+}
+
+uint64_t GetEnd(uint64_t chunks) {
+    return chunks & numeric_limits<uint32_t>::max();
+}
+
+struct Cpu {
+    size_t id;
+    size_t node;
+};
+
+// Parses a sysfs CPU list such as "0-3,8,10-11"
+vector<size_t> ParseCpuList(const string& text) {
+    vector<size_t> cpus;
+    istringstream input(text);
+    string range;
+    while (getline(input, range, ',')) {
+        if (range.empty()) {
+            continue;
+        }
+        const size_t dash = range.find('-');
+        const size_t first = stoul(range.substr(0, dash));
+        const size_t last = dash == string::npos ? first : stoul(range.substr(dash + 1));
+        for (size_t cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+// CPUs ordered by NUMA node. Machines without the node directory count as a single node
+vector<Cpu> GetCpus() {
+    vector<Cpu> cpus;
+    error_code error;
+    for (const auto& entry : filesystem::directory_iterator("/sys/devices/system/node", error)) {
+        const string name = entry.path().filename().string();
+        if (name.size() <= 4 || name.compare(0, 4, "node") != 0
+            || name.find_first_not_of("0123456789", 4) != string::npos) {
+            continue;
+        }
+        ifstream input(entry.path() / "cpulist");
+        string text;
+        if (!getline(input, text)) {
+            continue;
+        }
+        try {
+            for (const size_t cpu : ParseCpuList(text)) {
+                cpus.push_back({cpu, stoul(name.substr(4))});
+            }
+        } catch (const exception&) {
+            continue;
+        }
+    }
+    if (cpus.empty()) {
+        for (size_t cpu = 0; cpu < max(1u, thread::hardware_concurrency()); ++cpu) {
+            cpus.push_back({cpu, 0});
+        }
+    }
+    sort(cpus.begin(), cpus.end(), [](const Cpu& lhs, const Cpu& rhs) {
+        return lhs.node < rhs.node || (lhs.node == rhs.node && lhs.id < rhs.id);
+    });
+    return cpus;
+}
+
+void PinThread(thread& worker, size_t cpu) {
+#if defined(__linux__)
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    // Pinning is a hint, a worker that cannot be pinned still runs
+    pthread_setaffinity_np(worker.native_handle(), sizeof(cpu_set), &cpu_set);
+#endif
+}
+
+}  // namespace
+
+ThreadPool::ThreadPool(size_t thread_count)
+    : ThreadPool(thread_count, false) {
+}
+
+ThreadPool::ThreadPool(size_t thread_count, bool pin_threads) {
+    const size_t slot_count = max<size_t>(1, thread_count);
+    vector<size_t> slot_nodes(slot_count, 0);
+    vector<Cpu> cpus;
+    if (pin_threads) {
+        cpus = GetCpus();
+        for (size_t slot = 0; slot < slot_count; ++slot) {
+            slot_nodes[slot] = cpus[slot % cpus.size()].node;
+        }
+    }
+    steal_orders_.resize(slot_count);
+    for (size_t slot = 0; slot < slot_count; ++slot) {
+        for (size_t offset = 1; offset < slot_count; ++offset) {
+            steal_orders_[slot].push_back((slot + offset) % slot_count);
+        }
+        stable_partition(steal_orders_[slot].begin(), steal_orders_[slot].end(), [&](size_t victim) {
+            return slot_nodes[victim] == slot_nodes[slot];
+        });
+    }
+
+    workers_.reserve(slot_count - 1);
+    for (size_t i = 1; i < slot_count; ++i) {
+        workers_.emplace_back([this, i]() {
+            RunWorker(i);
+        });
+        if (pin_threads) {
+            PinThread(workers_.back(), cpus[i % cpus.size()].id);
+        }
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard guard(mutex_);
+        is_stopping_ = true;
+    }
+    loop_started_.notify_all();
+    for (thread& worker : workers_) {
+        worker.join();
+    }
+}
+
+ThreadPool& ThreadPool::GetDefault() {
+    static ThreadPool thread_pool;
+    return thread_pool;
+}
+
+size_t ThreadPool::GetThreadCount() const {
+    return workers_.size() + 1;
+}
+
+void ThreadPool::Enqueue(function<void()> task) {
+    {
+        lock_guard guard(mutex_);
+        tasks_.push_back(move(task));
+    }
+    loop_started_.notify_one();
+}
+
+void ThreadPool::Run(size_t count, size_t grain_size, const function<void(size_t, size_t)>& function) {
+    grain_size = max<size_t>(1, grain_size);
+    const size_t chunk_count = (count - 1) / grain_size + 1;
+    if (is_pool_thread || workers_.empty() || chunk_count == 1 || chunk_count > numeric_limits<uint32_t>::max()) {
+        for (size_t begin = 0; begin < count; begin += grain_size) {
+            function(begin, min(count, begin + grain_size));
+        }
+        return;
+    }
+
+    Loop loop;
+    loop.function = &function;
+    loop.count = count;
+    loop.grain_size = grain_size;
+    const size_t slot_count = GetThreadCount();
+    loop.ranges = make_unique<ChunkRange[]>(slot_count);
+    for (size_t slot = 0; slot < slot_count; ++slot) {
+        loop.ranges[slot].chunks.store(PackChunks(chunk_count * slot / slot_count, chunk_count * (slot + 1) / slot_count),
+                                       memory_order_relaxed);
+    }
+    loop.remaining_chunk_count.store(chunk_count, memory_order_relaxed);
+    {
+        lock_guard guard(mutex_);
+        loops_.push_back(&loop);
+    }
+    loop_started_.notify_all();
+
+    // Every caller owns slot 0 of its own loop, so callers of concurrent loops do not share a range
+    is_pool_thread = true;
+    RunChunks(loop, 0);
+    is_pool_thread = false;
+
+    unique_lock lock(mutex_);
+    loop.is_exhausted = true;
+    loop_finished_.wait(lock, [&loop]() {
+        return loop.remaining_chunk_count.load() == 0 && loop.active_worker_count == 0;
+    });
+    loops_.erase(find(loops_.begin(), loops_.end(), &loop));
+    if (loop.exception) {
+        rethrow_exception(loop.exception);
+    }
+}
+
+void ThreadPool::RunWorker(size_t slot) {
+    is_pool_thread = true;
+    unique_lock lock(mutex_);
+    while (true) {
+        Loop* loop = nullptr;
+        loop_started_.wait(lock, [&]() {
+            const auto it = find_if(loops_.begin(), loops_.end(), [](const Loop* loop) {
+                return !loop->is_exhausted;
+            });
+            loop = it == loops_.end() ? nullptr : *it;
+            return is_stopping_ || !tasks_.empty() || loop != nullptr;
+        });
+        if (loop == nullptr) {
+            if (tasks_.empty()) {
+                return;
+            }
+            function<void()> task = move(tasks_.front());
+            tasks_.pop_front();
+            lock.unlock();
+            task();
+            lock.lock();
+            continue;
+        }
+        ++loop->active_worker_count;
+        lock.unlock();
+        RunChunks(*loop, slot);
+        lock.lock();
+        loop->is_exhausted = true;
+        if (--loop->active_worker_count == 0) {
+            loop_finished_.notify_all();
+        }
+    }
+}
+
+void ThreadPool::RunChunks(Loop& loop, size_t slot) {
+    size_t chunk;
+    while (true) {
+        if (!PopChunk(loop, slot, chunk)) {
+            if (!StealChunks(loop, slot)) {
+                return;
+            }
+            continue;
+        }
+        if (!loop.is_failed.load(memory_order_relaxed)) {
+            const size_t begin = chunk * loop.grain_size;
+            try {
+                (*loop.function)(begin, min(loop.count, begin + loop.grain_size));
+            } catch (...) {
+                lock_guard guard(mutex_);
+                if (!loop.exception) {
+                    loop.exception = current_exception();
+                }
+                loop.is_failed.store(true, memory_order_relaxed);
+            }
+        }
+        if (loop.remaining_chunk_count.fetch_sub(1) == 1) {
+            lock_guard guard(mutex_);
+            loop_finished_.notify_all();
+        }
+    }
+}
+
+bool ThreadPool::PopChunk(Loop& loop, size_t slot, size_t& chunk) {
+    atomic<uint64_t>& chunks = loop.ranges[slot].chunks;
+    uint64_t current = chunks.load();
+    while (GetBegin(current) < GetEnd(current)) {
+        if (chunks.compare_exchange_weak(current, PackChunks(GetBegin(current) + 1, GetEnd(current)))) {
+            chunk = GetBegin(current);
+            return true;
+        }
+    }
+    return false;
+}
+
+// The stolen chunks are stored with a plain store: the range of the thief is empty, and thieves skip empty ranges
+bool ThreadPool::StealChunks(Loop& loop, size_t slot) {
+    for (const size_t victim_slot : steal_orders_[slot]) {
+        atomic<uint64_t>& victim = loop.ranges[victim_slot].chunks;
+        uint64_t current = victim.load();
+        while (GetBegin(current) < GetEnd(current)) {
+            const uint64_t middle = GetBegin(current) + (GetEnd(current) - GetBegin(current)) / 2;
+            if (victim.compare_exchange_weak(current, PackChunks(GetBegin(current), middle))) {
+                loop.ranges[slot].chunks.store(PackChunks(middle, GetEnd(current)));
+                return true;
+            }
+        }
+    }
+    return false;
+}
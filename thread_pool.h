@@ -0,0 +1,216 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#include <optional>
+#endif
+
+// Fixed set of threads running parallel loops with work stealing. Each thread owns a range of chunks and
+// takes them from its front; a thread that runs out steals the back half of the range of another one, so
+// uneven chunks keep every thread busy until the loop ends. Thieves look at the threads of their own NUMA
+// node first. Single tasks can be submitted as well, and awaited from coroutines where they are supported
+class ThreadPool {
+public:
+    // thread_count includes the thread calling ParallelFor, the pool starts thread_count - 1 workers
+    explicit ThreadPool(size_t thread_count = std::thread::hardware_concurrency());
+    // Pinned workers fill the CPUs of one NUMA node before taking the next one, as listed in
+    // /sys/devices/system/node. The calling thread is not pinned and counts as being on the first CPU
+    ThreadPool(size_t thread_count, bool pin_threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Pool with a thread per core, started on first use
+    static ThreadPool& GetDefault();
+
+    size_t GetThreadCount() const;
+
+    // Calls function(begin, end) for chunks of at most grain_size indexes covering [0, count) and returns
+    // once all of them are done. The first exception thrown by function is rethrown, the chunks not started
+    // by then are skipped. Loops started by several threads at once share the workers, which help the oldest
+    // loop with chunks left. Loops started from a chunk or a task are nested and run sequentially
+    template <typename Function>
+    void ParallelFor(size_t count, size_t grain_size, Function function);
+
+    // Sorts [first, last) of random access iterators like std::sort: every thread sorts a run, then neighbouring
+    // runs are merged pairwise in parallel
+    template <typename Iterator, typename Compare = std::less<>>
+    void Sort(Iterator first, Iterator last, Compare compare = {});
+
+    // Runs function() on a worker, the future gets its result or exception. Workers take tasks in the order
+    // of submission when no loop needs them. A pool without workers runs the task before returning.
+    // Tasks submitted before the pool is destroyed still run
+    template <typename Function>
+    std::future<std::invoke_result_t<Function>> Submit(Function function);
+
+#if defined(__cpp_impl_coroutine)
+    // co_await runs function() as a task and resumes the coroutine on the worker that ran it, with its result
+    // or exception. A suspended coroutine holds no thread. Without workers the function runs on the awaiting one
+    template <typename Function>
+    class Awaitable;
+
+    template <typename Function>
+    Awaitable<Function> Schedule(Function function);
+#endif
+
+private:
+    // Chunks [begin, end) of a thread packed as begin << 32 | end, so both ends change with one CAS
+    struct alignas(64) ChunkRange {
+        std::atomic<uint64_t> chunks{0};
+    };
+
+    struct Loop {
+        const std::function<void(size_t, size_t)>* function = nullptr;
+        size_t count = 0;
+        size_t grain_size = 1;
+        std::unique_ptr<ChunkRange[]> ranges;
+        std::atomic<size_t> remaining_chunk_count{0};
+        std::atomic<bool> is_failed{false};
+        std::exception_ptr exception;  // Guarded by mutex_
+        size_t active_worker_count = 0;  // Guarded by mutex_
+        bool is_exhausted = false;  // Guarded by mutex_, set once a thread found no chunk to run or steal
+    };
+
+    std::vector<std::thread> workers_;
+    std::vector<std::vector<size_t>> steal_orders_;  // Victims of every slot, slots of the same node first
+    std::mutex mutex_;
+    std::condition_variable loop_started_;
+    std::condition_variable loop_finished_;
+    std::vector<Loop*> loops_;  // Running loops in the order they started
+    std::deque<std::function<void()>> tasks_;
+    bool is_stopping_ = false;
+
+    void Enqueue(std::function<void()> task);
+    void Run(size_t count, size_t grain_size, const std::function<void(size_t, size_t)>& function);
+    void RunWorker(size_t slot);
+    // Runs chunks of the loop until none is left, slot is the range owned by the thread
+    void RunChunks(Loop& loop, size_t slot);
+    bool PopChunk(Loop& loop, size_t slot, size_t& chunk);
+    bool StealChunks(Loop& loop, size_t slot);
+};
+
+template <typename Function>
+void ThreadPool::ParallelFor(size_t count, size_t grain_size, Function function) {
+    if (count == 0) {
+        return;
+    }
+    const std::function<void(size_t, size_t)> chunk_function = std::ref(function);
+    Run(count, grain_size, chunk_function);
+}
+
+template <typename Iterator, typename Compare>
+void ThreadPool::Sort(Iterator first, Iterator last, Compare compare) {
+    // Shorter runs are sorted faster by one thread than they are merged
+    constexpr size_t min_run_size = 4096;
+    const size_t count = last - first;
+    const size_t run_count = std::clamp<size_t>(count / min_run_size, 1, GetThreadCount());
+    if (run_count == 1) {
+        std::sort(first, last, compare);
+        return;
+    }
+    const auto get_run_begin = [first, count, run_count](size_t run) {
+        return first + count * std::min(run, run_count) / run_count;
+    };
+    ParallelFor(run_count, 1, [&](size_t begin, size_t end) {
+        for (size_t run = begin; run < end; ++run) {
+            std::sort(get_run_begin(run), get_run_begin(run + 1), compare);
+        }
+    });
+    for (size_t width = 1; width < run_count; width *= 2) {
+        const size_t merge_count = (run_count + 2 * width - 1) / (2 * width);
+        ParallelFor(merge_count, 1, [&](size_t begin, size_t end) {
+            for (size_t merge = begin; merge < end; ++merge) {
+                const size_t run = merge * 2 * width;
+                std::inplace_merge(get_run_begin(run), get_run_begin(run + width), get_run_begin(run + 2 * width), compare);
+            }
+        });
+    }
+}
+
+template <typename Function>
+std::future<std::invoke_result_t<Function>> ThreadPool::Submit(Function function) {
+    // std::function needs a copyable target, the task itself is move-only
+    auto task = std::make_shared<std::packaged_task<std::invoke_result_t<Function>()>>(std::move(function));
+    auto result = task->get_future();
+    if (workers_.empty()) {
+        (*task)();
+    } else {
+        Enqueue([task]() {
+            (*task)();
+        });
+    }
+    return result;
+}
+
+#if defined(__cpp_impl_coroutine)
+template <typename Function>
+class ThreadPool::Awaitable {
+public:
+    using Result = std::invoke_result_t<Function>;
+    static_assert(!std::is_void_v<Result>, "Awaited functions return a value");
+
+    Awaitable(ThreadPool& thread_pool, Function function)
+        : thread_pool_(thread_pool)
+        , function_(std::move(function)) {
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    // The awaitable lives in the coroutine frame until it resumes, so the task may refer to it
+    bool await_suspend(std::coroutine_handle<> handle) {
+        if (thread_pool_.workers_.empty()) {
+            Invoke();
+            return false;
+        }
+        thread_pool_.Enqueue([this, handle]() {
+            Invoke();
+            handle.resume();
+        });
+        return true;
+    }
+
+    Result await_resume() {
+        if (exception_) {
+            std::rethrow_exception(exception_);
+        }
+        return std::move(*result_);
+    }
+
+private:
+    ThreadPool& thread_pool_;
+    Function function_;
+    std::optional<Result> result_;
+    std::exception_ptr exception_;
+
+    void Invoke() noexcept {
+        try {
+            result_.emplace(function_());
+        } catch (...) {
+            exception_ = std::current_exception();
+        }
+    }
+};
+
+template <typename Function>
+ThreadPool::Awaitable<Function> ThreadPool::Schedule(Function function) {
+    return Awaitable<Function>(*this, std::move(function));
+}
+#endif
@@ -0,0 +1,79 @@
+#include "top_documents.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+bool IsMoreRelevant(const Document& lhs, const Document& rhs) {
+    if (abs(lhs.relevance - rhs.relevance) < RELEVANCE_EPSILON) {
+        if (lhs.rating != rhs.rating) {
+            return lhs.rating > rhs.rating;
+        }
+        return lhs.id < rhs.id;
+    }
+    return lhs.relevance > rhs.relevance;
+}
+
+TopDocuments::TopDocuments(size_t capacity)
+    : capacity_(capacity) {
+}
+
+void TopDocuments::Reset(size_t capacity) {
+    capacity_ = capacity;
+    heap_.clear();
+}
+
+void TopDocuments::Push(const Document& document) {
+    if (heap_.size() < capacity_) {
+        heap_.push_back(document);
+        push_heap(heap_.begin(), heap_.end(), IsMoreRelevant);
+    } else if (capacity_ > 0 && IsMoreRelevant(document, heap_.front())) {
+        pop_heap(heap_.begin(), heap_.end(), IsMoreRelevant);
+        heap_.back() = document;
+        push_heap(heap_.begin(), heap_.end(), IsMoreRelevant);
+    }
+}
+
+void TopDocuments::Merge(const TopDocuments& other) {
+    for (const Document& document : other.heap_) {
+        Push(document);
+    }
+}
+
+bool TopDocuments::IsFull() const {
+    return capacity_ > 0 && heap_.size() == capacity_;
+}
+
+const Document& TopDocuments::GetWorst() const {
+    return heap_.front();
+}
+
+double TopDocuments::GetAdmissionThreshold() const {
+    if (!IsFull()) {
+        return -numeric_limits<double>::infinity();
+    }
+    return heap_.front().relevance - RELEVANCE_EPSILON;
+}
+
+size_t TopDocuments::size() const {
+    return heap_.size();
+}
+
+bool TopDocuments::empty() const {
+    return heap_.empty();
+}
+
+vector<Document> TopDocuments::ExtractSorted() {
+    sort_heap(heap_.begin(), heap_.end(), IsMoreRelevant);
+    vector<Document> result;
+    result.swap(heap_);
+    return result;
+}
+
+void TopDocuments::ExtractSorted(vector<Document>& result) {
+    sort_heap(heap_.begin(), heap_.end(), IsMoreRelevant);
+    result.assign(heap_.begin(), heap_.end());
+    heap_.clear();
+}
\ No newline at end of file
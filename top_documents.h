@@ -0,0 +1,41 @@
+#pragma once
+
+#include "document.h"
+
+#include <cstddef>
+#include <vector>
+
+// Relevances closer than this are considered equal
+const double RELEVANCE_EPSILON = 1e-6;
+
+// Search result order: relevance first, then rating, then lower id for a stable order
+bool IsMoreRelevant(const Document& lhs, const Document& rhs);
+
+// Keeps the best `capacity` documents pushed so far in a bounded heap
+class TopDocuments {
+public:
+    explicit TopDocuments(size_t capacity);
+
+    // Empties the collector for a new capacity, the allocated memory is kept
+    void Reset(size_t capacity);
+    void Push(const Document& document);
+    void Merge(const TopDocuments& other);
+
+    bool IsFull() const;
+    // The kept document with the lowest rank, heap must be non-empty
+    const Document& GetWorst() const;
+    // Documents with relevance <= threshold can no longer get into the top
+    double GetAdmissionThreshold() const;
+
+    size_t size() const;
+    bool empty() const;
+
+    // Leaves the collector empty, result is ordered by IsMoreRelevant
+    std::vector<Document> ExtractSorted();
+    // Same, reusing the memory of result
+    void ExtractSorted(std::vector<Document>& result);
+
+private:
+    size_t capacity_;
+    std::vector<Document> heap_;  // The worst kept document is at the front
+};
\ No newline at end of file